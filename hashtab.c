@@ -130,6 +130,7 @@ word  logsize;    /* log base 2 of the size of the hash table */
   t->apos = (ub4)0;
   t->ipos = (hitem *)0;
   t->space = remkroot(sizeof(hitem));
+  relabel(t->space, "hashtab.c, hitem");
   t->bcount = 0;
   return t;
 }
@@ -144,6 +145,19 @@ htab  *t;    /* the table */
   free((char *)t);
 }
 
+/* hclear - empty the hash table but keep its memory */
+void hclear( t)
+htab  *t;    /* the table */
+{
+  ub4 i;
+  for (i=0; i<=t->mask; ++i) t->table[i] = (hitem *)0;
+  rereset(t->space);
+  t->count = 0;
+  t->apos = (ub4)0;
+  t->ipos = (hitem *)0;
+  t->bcount = 0;
+}
+
 /* hcount() is a macro, see hashtab.h */
 /* hkey() is a macro, see hashtab.h */
 /* hkeyl() is a macro, see hashtab.h */
@@ -15,6 +15,7 @@ This implements a hash table.
 
   hcreate  - create a hash table
   hdestroy - destroy a hash table
+  hclear   - empty a hash table, keeping its memory for reuse
    hcount  - The number of items in the hash table
    hkey    - key at the current position
    hkeyl   - key length at the current position
@@ -87,6 +88,20 @@ htab *hcreate(/*_ word logsize _*/);
 void  hdestroy(/*_ htab *t _*/);
 
 
+/* hclear - remove every item from a hash table
+   ARGUMENTS:
+     t - the hash table to be emptied.  As with hdestroy, keys and stuff
+         are not freed.
+   RETURNS:
+     nothing
+   NOTE:
+     The table keeps its current length and the memory for its items,
+       so a table that is filled and cleared over and over stops calling
+       malloc once it has reached its largest size.
+ */
+void  hclear(/*_ htab *t _*/);
+
+
 /* hcount, hkey, hkeyl, hstuff
      ARGUMENTS:
      t - the hash table
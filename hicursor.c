@@ -21,6 +21,7 @@ cursors, which represent a current position in that table.
   hiprev    - move cursor to the previous item in the table
   hilast    - move cursor to the last item in the table
    hifind   - find an item in the table
+  hifind_many - find many keys at once, overlapping their cache misses
   hicount   - The number of items in the hash table
   hiccount  - The number of cursors the hash table
   hikey     - key at the current position
@@ -28,6 +29,10 @@ cursors, which represent a current position in that table.
    histat   - print statistics about the table
   hiadd     - insert an item into the table
   hidel     - delete an item from the table
+  hienter   - start a read-side critical section (THREADS only)
+  hiexit    - end a read-side critical section (THREADS only)
+  hilock    - start a sequence of writes (THREADS only)
+  hiunlock  - end a sequence of writes (THREADS only)
 --------------------------------------------------------------------
 */
 
@@ -120,23 +125,131 @@ static ub4 hihash(ub4 key)
   return x;
 }
 
-/* sanity check -- make sure ipos, apos, and count make sense */
-static void  hisanity(hitab *t)
+#ifdef THREADS
+/*
+ * Readers never lock.  Every pointer a reader follows is published with a
+ * release store after the thing it points at is complete, and read with an
+ * acquire load.  table and mask change together under the seqcount seq.
+ */
+# define HILOAD(p)    __atomic_load_n((p), __ATOMIC_ACQUIRE)
+# define HISTORE(p,v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+# define HISNAP(t,table,mask) ((table) = hisnap((t), &(mask)))
+#else
+# define HILOAD(p)    (*(p))
+# define HISTORE(p,v) (*(p) = (v))
+# define HISNAP(t,table,mask) ((table) = (t)->table, (mask) = (t)->mask)
+#endif
+
+#ifdef THREADS
+
+/* in a retired hint, key is the log size of a retired table, or this */
+#define HIRETIRE_HINT ((ub4)~0)
+
+/* hisnap - get a table and mask that belong together, even during higrow */
+static hint **hisnap(hitab *t, size_t *mask)
+{
+  ub4    seq;
+  hint **table;
+  do {
+    seq    = __atomic_load_n(&t->seq, __ATOMIC_ACQUIRE);
+    table  = __atomic_load_n(&t->table, __ATOMIC_RELAXED);
+    *mask  = __atomic_load_n(&t->mask, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  } while ((seq & 1) || seq != __atomic_load_n(&t->seq, __ATOMIC_RELAXED));
+  return table;
+}
+
+/* hienter - announce the current epoch; nothing retired after this is freed */
+void hienter(hicursor *c)
+{
+  hitab *t = c->tab;
+  ub4    epoch;
+  do {
+    epoch = __atomic_load_n(&t->epoch, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&c->epoch, epoch, __ATOMIC_SEQ_CST);
+  } while (epoch != __atomic_load_n(&t->epoch, __ATOMIC_SEQ_CST));
+}
+
+/* hiexit - leave the epoch, the position of c is no longer protected */
+void hiexit(hicursor *c)
+{
+  __atomic_store_n(&c->epoch, (ub4)0, __ATOMIC_RELEASE);
+}
+
+/* hireclaim - really free everything on one limbo list */
+static void hireclaim(hitab *t, hint **limbo)
+{
+  hint *rec, *h, *next;
+  ub4   i;
+
+  while ((rec = *limbo)) {
+    *limbo = rec->next;
+    if (rec->key == HIRETIRE_HINT) {
+      redel(t->space, rec->stuff);
+    } else {
+      /* an old table, plus the old copies of the hints chained from it */
+      hint **oldtab = (hint **)rec->stuff;
+      for (i=0; i < ((ub4)1<<rec->key); ++i) {
+        for (h=oldtab[i]; h; h=next) {
+          next = h->next;
+          redel(t->space, h);
+        }
+      }
+      free((char *)oldtab);
+    }
+    redel(t->space, rec);
+  }
+}
+
+/*
+ * hiadvance - move to the next epoch if every cursor inside an epoch is
+ * inside the current one.  Then nobody can still see what was retired two
+ * epochs ago, so that gets freed.  Caller holds wlock.
+ */
+static void hiadvance(hitab *t)
 {
+  hicursor *c;
+  ub4       epoch = t->epoch;
+
+  for (c = t->cursors; c; c = c->cnext) {
+    ub4 e = __atomic_load_n(&c->epoch, __ATOMIC_SEQ_CST);
+    if (e && e != epoch)
+      return;                             /* some reader is still behind */
+  }
+  if (!++epoch) ++epoch;                             /* epoch 0 means idle */
+  hireclaim(t, &t->limbo[(epoch+1)%3]);          /* retired in epoch-2 */
+  __atomic_store_n(&t->epoch, epoch, __ATOMIC_SEQ_CST);
+}
+
+/* hiretire - free something once no reader can reach it.  Caller holds wlock */
+static void hiretire(hitab *t, void *stuff, ub4 kind)
+{
+  hint *rec = (hint *)renew(t->space);
+  rec->stuff = stuff;
+  rec->key   = kind;
+  rec->next  = t->limbo[t->epoch%3];
+  t->limbo[t->epoch%3] = rec;
+  hiadvance(t);
+}
+
+#endif /* THREADS */
+
+
+/* sanity check -- make sure the position and count make sense */
+static void  hisanity(hicursor *c)
+{
+  hitab *t = c->tab;
   ub4    i, end, counter;
   hint  *h;
 
-  /* test that apos makes sense */
   end = (ub4)1<<(t->logsize);
-  if (end < t->apos)
-    printf("error:  end %ld  apos %ld\n", end, t->apos);
 
-  /* test that ipos is in bucket apos */
-  if (t->ipos) {
-    for (h=t->table[t->apos];  h && h != t->ipos;  h = h->next)
+  /* test that ipos is in the bucket of key */
+  if (c->ipos) {
+    for (h=t->table[hihash(c->key)&t->mask];  h && h != c->ipos;  h = h->next)
       ;
-    if (h != t->ipos)
-      printf("error:ipos not in apos, apos is %ld\n", t->apos);
+    if (h != c->ipos)
+      printf("error: ipos not in the bucket for key %ld\n", c->key);
   }
 
   /* test that t->count is the number of elements in the table */
@@ -154,10 +267,13 @@ static void  hisanity(hitab *t)
  * Allocate a new, 2x bigger array,
  * move everything from the old array to the new array,
  * then free the old array.
+ * With THREADS, readers may still be walking the old chains, so the hints
+ * are copied rather than moved, and the old array and hints are retired.
  */
-static void higrow(hitab *t)
+static void higrow(hicursor *c)
 {
-  register ub4    newsize = (ub4)1<<(++t->logsize);
+  register hitab *t = c->tab;
+  register ub4    newsize = (ub4)1<<(t->logsize+1);
   register ub4    newmask = newsize-1;
   register ub4    i;
   register hint **oldtab = t->table;
@@ -166,14 +282,18 @@ static void higrow(hitab *t)
   /* make sure newtab is cleared */
   for (i=0; i<newsize; ++i)
     newtab[i] = (hint *)0;
-  t->table = newtab;
-  t->mask = newmask;
 
   /* Walk through old table putting entries in new table */
   for (i=newsize>>1; i--;) {
     register hint *this, *that, **newplace;
     for (this = oldtab[i]; this;) {
+#ifdef THREADS
+      that = (hint *)renew(t->space);
+      that->key   = this->key;
+      that->stuff = this->stuff;
+#else
       that = this;
+#endif
       this = this->next;
       newplace = &newtab[(hihash(that->key) & newmask)];
       that->next = *newplace;
@@ -181,12 +301,26 @@ static void higrow(hitab *t)
     }
   }
 
-  /* position the hash table on some existing item */
-  hifirst(t);
+#ifdef THREADS
+  /* swap in the new array; hisnap retries while seq is odd */
+  __atomic_store_n(&t->seq, t->seq+1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  __atomic_store_n(&t->table, newtab, __ATOMIC_RELAXED);
+  __atomic_store_n(&t->mask, (size_t)newmask, __ATOMIC_RELAXED);
+  __atomic_store_n(&t->seq, t->seq+1, __ATOMIC_RELEASE);
+  hiretire(t, oldtab, (ub4)t->logsize);
+  ++t->logsize;
+#else
+  t->table = newtab;
+  t->mask = newmask;
+  ++t->logsize;
 
   /* free the old array */
   free((char *)oldtab);
+#endif
 
+  /* position the cursor on some existing item */
+  hifirst(c);
 }
 
 /* hicreate - create a new hash table of integers */
@@ -201,19 +335,36 @@ hicursor *hicreate(word logsize)  /* log base 2 of initial hash table size */
   t->logsize = logsize;
   t->mask = len-1;
   t->count = 0;
-  t->apos = (ub4)0;
-  t->ipos = (hint *)0;
   t->bcount = 0;
   t->space = remkroot(max(sizeof(hint),sizeof(hicursor)));
+  relabel(t->space, "hicursor.c, hint");
   cursor = (hicursor *)renew(t->space);
+  cursor->tab = t;
+  cursor->key = 0;
+  cursor->ipos = (hint *)0;
   t->ccount = 1;
-  return t;
+#ifdef THREADS
+  pthread_mutex_init(&t->wlock, (pthread_mutexattr_t *)0);
+  t->seq = 0;
+  t->epoch = 1;
+  for (i=0; i<3; ++i) t->limbo[i] = (hint *)0;
+  t->cursors = cursor;
+  cursor->epoch = 0;
+  cursor->cnext = (hicursor *)0;
+#endif
+  return cursor;
 }
 
 /* hidestroy - destroy a hash table and all its cursors, free all memory*/
 void hidestroy(hicursor *c)
 {
   hitab *t = c->tab;
+#ifdef THREADS
+  word   i;
+  for (i=0; i<3; ++i)
+    hireclaim(t, &t->limbo[i]);
+  pthread_mutex_destroy(&t->wlock);
+#endif
   refree(t->space);
   free((char *)t->table);
   free((char *)t);
@@ -224,21 +375,83 @@ void hidestroy(hicursor *c)
 /* histuff() is a macro, see hicursor.h */
 
 /* hifind - find an item with a given key in a hash table */
-word   hifind(hitab *t, ub4 key )
+word   hifind(hicursor *c, ub4 key )
 {
-  hint *h;
-  ub4    x = hihash(key);
-  ub4    y;
-  for (h = t->table[y=(x&t->mask)]; h; h = h->next) {
+  hint   *h;
+  hint  **table;
+  size_t  mask;
+
+  HISNAP(c->tab, table, mask);
+  for (h = HILOAD(&table[hihash(key)&mask]); h; h = HILOAD(&h->next)) {
     if (key == h->key) {
-      t->apos = y;
-      t->ipos = h;
+      c->key = key;
+      c->ipos = h;
       return TRUE;
     }
   }
   return FALSE;
 }
 
+/* hiprefetch - hint that *p will be read soon; does nothing if unsupported */
+#ifdef __GNUC__
+# define hiprefetch(p) __builtin_prefetch((const void *)(p), 0, 1)
+#else
+# define hiprefetch(p)
+#endif
+
+/*
+ * hifind_many - find a batch of keys.
+ * Key i+HIWINDOW is hashed and its bucket prefetched while key i is being
+ * resolved.  Halfway through the window the bucket has arrived, so the first
+ * hint in it gets prefetched too.  y[] is a ring of buckets in flight.
+ */
+size_t hifind_many(hitab *t, const ub4 *keys, size_t n, void **out)
+{
+  ub4     y[HIWINDOW];           /* y[i&(HIWINDOW-1)] is the bucket of key i */
+  size_t  i;
+  size_t  found = 0;
+  size_t  mask;
+  hint  **table;
+  hint   *h;
+
+  HISNAP(t, table, mask);
+
+  /* get the first window of buckets on their way */
+  for (i=0; i<n && i<HIWINDOW; ++i) {
+    y[i] = hihash(keys[i]) & mask;
+    hiprefetch(&table[y[i]]);
+  }
+
+  for (i=0; i<n; ++i) {
+    ub4 key = keys[i];
+    ub4 j   = i & (HIWINDOW-1);
+
+    /* the bucket halfway down the window is in cache, fetch its first hint */
+    if (i+HIWINDOW/2 < n) {
+      h = HILOAD(&table[y[(i+HIWINDOW/2) & (HIWINDOW-1)]]);
+      if (h) hiprefetch(h);
+    }
+
+    /* resolve key i, by now its bucket and first hint should be cached */
+    for (h = HILOAD(&table[y[j]]); h; h = HILOAD(&h->next))
+      if (key == h->key)
+        break;
+    if (h) {
+      out[i] = h->stuff;
+      ++found;
+    } else {
+      out[i] = (void *)0;
+    }
+
+    /* reuse the slot for the key one window ahead */
+    if (i+HIWINDOW < n) {
+      y[j] = hihash(keys[i+HIWINDOW]) & mask;
+      hiprefetch(&table[y[j]]);
+    }
+  }
+  return found;
+}
+
 /* hicopy - make a copy of an existing cursor */
 hicursor *hicopy(hicursor *c)
 {
@@ -246,6 +459,11 @@ hicursor *hicopy(hicursor *c)
   hicursor *c2 = (hicursor *)renew(t->space);
   *c2 = *c;
   ++t->ccount;
+#ifdef THREADS
+  c2->epoch = 0;
+  c2->cnext = t->cursors;
+  t->cursors = c2;
+#endif
   return c2;
 }
 
@@ -253,6 +471,12 @@ hicursor *hicopy(hicursor *c)
 void hifree(hicursor *c)
 {
   hitab    *t = c->tab;
+#ifdef THREADS
+  hicursor **cp;
+  for (cp = &t->cursors; *cp != c; cp = &(*cp)->cnext)
+    ;
+  *cp = c->cnext;
+#endif
   --t->ccount;
   if (!t->ccount)
     hidestroy(c);
@@ -266,14 +490,15 @@ void hifree(hicursor *c)
  */
 word hiadd(hicursor *c, ub4 key, void *stuff)
 {
+  register hitab *t = c->tab;
   register hint  *h,**hp;
   register ub4    y, x = hihash(key);
 
   /* make sure the key is not already there */
   for (h = t->table[(y=(x&t->mask))]; h; h = h->next) {
     if (key == h->key) {
-      t->apos = y;
-      t->ipos = h;
+      c->key = key;
+      c->ipos = h;
       return FALSE;
     }
   }
@@ -283,99 +508,134 @@ word hiadd(hicursor *c, ub4 key, void *stuff)
 
   /* make the hash table bigger if it is getting full */
   if (++t->count > (ub4)1<<(t->logsize)) {
-    higrow(t);
+    higrow(c);
     y = (x&t->mask);
   }
 
-  /* add the new key to the table */
+  /* add the new key to the table, only publishing it once it is complete */
   h->key   = key;
   h->stuff = stuff;
   hp = &t->table[y];
   h->next = *hp;
-  *hp = h;
-  t->ipos = h;
-  t->apos = y;
+  HISTORE(hp, h);
+  c->key = key;
+  c->ipos = h;
 
 #ifdef HSANITY
-  hisanity(t);
+  hisanity(c);
 #endif  /* HSANITY */
 
   return TRUE;
 }
 
-/* hdel - delete the item at the current position */
-word  hidel(hitab *t)
+/* hidel - delete the item at the current position */
+word  hidel(hicursor *c)
 {
+  hitab *t = c->tab;
   hint  *h;    /* item being deleted */
   hint **ip;   /* a counter */
 
   /* check for item not existing */
-  if (!(h = t->ipos))
+  if (!c->ipos)
     return FALSE;
 
-  /* remove item from its list */
-  for (ip = &t->table[t->apos]; *ip != h; ip = &(*ip)->next)
-    ;
-  *ip = (*ip)->next;
+  /*
+   * Look for the item by key, not by ipos.  With THREADS, a higrow by
+   * another cursor copies every hint, leaving ipos on a retired copy.
+   */
+  for (ip = &t->table[hihash(c->key)&t->mask]; (h = *ip); ip = &h->next)
+    if (h->key == c->key)
+      break;
+  if (!h) {
+    hinbucket(c);                        /* another cursor deleted it first */
+    return FALSE;
+  }
+
+  /* remove item from its list; readers already on h can still leave it */
+  HISTORE(ip, h->next);
   --(t->count);
 
   /* adjust position to something that exists */
-  if (!(t->ipos = h->next))
-    hinbucket(t);
+  if ((c->ipos = h->next))
+    c->key = c->ipos->key;
+  else
+    hinbucket(c);
 
   /* recycle the deleted hint node */
+#ifdef THREADS
+  hiretire(t, h, HIRETIRE_HINT);
+#else
   redel(t->space, h);
+#endif
 
 #ifdef HSANITY
-  hsanity(t);
+  hisanity(c);
 #endif  /* HSANITY */
 
   return TRUE;
 }
 
-/* hifirst - position on the first element in the table */
-word hifirst(hitab *t)
-{
-  t->apos = t->mask;
-  (void)hinbucket(t);
-  return (t->ipos != (hint *)0);
-}
-
-/* hinext() is a macro, see hicursor.h */
-
 /*
- * hinbucket - Move position to the first item in the next bucket.
- * Return TRUE if we did not wrap around to the beginning of the table
+ * hiscan - position on the first item in bucket start or later.
+ * Return TRUE if we did not wrap around to the beginning of the table.
  */
-word hinbucket(hitab *t)
+static word hiscan(hicursor *c, hint **table, size_t mask, size_t start)
 {
-  ub4  oldapos = t->apos;
-  ub4  end = (ub4)1<<(t->logsize);
-  ub4  i;
+  size_t  i;
+  hint   *h;
 
   /* see if the element can be found without wrapping around */
-  for (i=oldapos+1; i<end; ++i) {
-    if (t->table[i&t->mask]) {
-      t->apos = i;
-      t->ipos = t->table[i];
+  for (i=start; i<=mask; ++i) {
+    if ((h = HILOAD(&table[i]))) {
+      c->key  = h->key;
+      c->ipos = h;
       return TRUE;
     }
   }
 
   /* must have to wrap around to find the last element */
-  for (i=0; i<=oldapos; ++i) {
-    if (t->table[i]) {
-      t->apos = i;
-      t->ipos = t->table[i];
+  for (i=0; i<start && i<=mask; ++i) {
+    if ((h = HILOAD(&table[i]))) {
+      c->key  = h->key;
+      c->ipos = h;
       return FALSE;
     }
   }
 
+  c->ipos = (hint *)0;                                    /* table is empty */
   return FALSE;
 }
 
-void histat(hitab *t)
+/* hifirst - position on the first element in the table */
+word hifirst(hicursor *c)
 {
+  hint  **table;
+  size_t  mask;
+
+  HISNAP(c->tab, table, mask);
+  (void)hiscan(c, table, mask, (size_t)0);
+  return (c->ipos != (hint *)0);
+}
+
+/* hinext() is a macro, see hicursor.h */
+
+/*
+ * hinbucket - Move position to the first item in the next bucket.
+ * The bucket we are leaving is the one for c->key.
+ * Return TRUE if we did not wrap around to the beginning of the table
+ */
+word hinbucket(hicursor *c)
+{
+  hint  **table;
+  size_t  mask;
+
+  HISNAP(c->tab, table, mask);
+  return hiscan(c, table, mask, (hihash(c->key)&mask)+1);
+}
+
+void histat(hicursor *c)
+{
+  hitab *t = c->tab;
   ub4    i,j;
   double total = 0.0; /* higgledy piggledy, thisaway, thataway */
   hint  *h;
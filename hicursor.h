@@ -21,6 +21,7 @@ cursors, which represent a current position in that table.
   hiprev    - move cursor to the previous item in the table
   hilast    - move cursor to the last item in the table
    hifind   - find an item in the table
+  hifind_many - find many keys at once, overlapping their cache misses
   hicount   - The number of items in the hash table
   hiccount  - The number of cursors the hash table
   hikey     - key at the current position
@@ -28,6 +29,17 @@ cursors, which represent a current position in that table.
    histat   - print statistics about the table
   hiadd     - insert an item into the table
   hidel     - delete an item from the table
+  hienter   - start a read-side critical section (THREADS only)
+  hiexit    - end a read-side critical section (THREADS only)
+  hilock    - start a sequence of writes (THREADS only)
+  hiunlock  - end a sequence of writes (THREADS only)
+
+Compiled with -DTHREADS, any number of cursors in different threads may
+read (hifind, hifirst, hinext, hifind_many) while one thread at a time
+writes (hiadd, hidel, and the higrow that hiadd may cause).  Readers never
+block.  Writers retire deleted hints and replaced tables to limbo lists
+tagged with an epoch, and they are recycled only after every cursor has
+been seen outside that epoch (epoch-based reclamation).
 --------------------------------------------------------------------
 */
 
@@ -38,6 +50,10 @@ cursors, which represent a current position in that table.
 #ifndef HICURSOR
 #define HICURSOR
 
+#ifdef THREADS
+# include <pthread.h>
+#endif
+
 /* PRIVATE TYPES AND FUNCTIONS */
 
 /* private - hash table entry */
@@ -58,20 +74,29 @@ struct hitab
   ub4            count;   /* how many items in this hash table so far? */
   struct reroot *space;   /* space for the hints */
   ub4            bcount;  /* # hints useable in current block */
-  ub4            count;   /* number of cursors using this table */
+  ub4            ccount;  /* number of cursors using this table */
+#ifdef THREADS
+  pthread_mutex_t  wlock;    /* held by the one thread allowed to write */
+  ub4              seq;      /* odd while table and mask are being replaced */
+  ub4              epoch;    /* current epoch, never 0 */
+  struct hint     *limbo[3]; /* retired stuff, indexed by epoch%3 */
+  struct hicursor *cursors;  /* every cursor on this table */
+#endif
 };
 typedef  struct hitab  hitab;
 
 
+struct hicursor;
+
 /* hinbucket - PRIVATE - move to first item in the next nonempty bucket
   ARGUMENTS:
-    t    - the hash table
+    c    - a cursor on the hash table
   RETURNS:
     FALSE if the position wraps around to the beginning of the table
   NOTE:
     This is private to hicursor; do not use it externally.
  */
-word hinbucket( hitab *t );
+word hinbucket( struct hicursor *c );
 
 
 /* PUBLIC TYPES AND FUNCTIONS */
@@ -82,6 +107,10 @@ struct hicursor
   hitab         *tab;     /* hash table this cursor is on */
   ub4            key;     /* current key */
   struct hint   *ipos;    /* current item in the array */
+#ifdef THREADS
+  ub4              epoch;  /* epoch this cursor entered in, 0 if outside */
+  struct hicursor *cnext;  /* next cursor on the same table */
+#endif
 };
 typedef  struct hicursor  hicursor;
 
@@ -127,7 +156,7 @@ void  hidestroy( hicursor *c );
    RETURNS:
      another cursor on the same table pointing at the same place
  */
-word  hicopy( hicursor *c );
+hicursor *hicopy( hicursor *c );
 
 /* hifree - free a cursor on a hash table of integers
    ARGUMENTS:
@@ -137,7 +166,7 @@ word  hicopy( hicursor *c );
    NOTE:
      If this is the last cursor on the table, the table gets freed as well.
  */
-word  hifree( hicursor *c );
+void  hifree( hicursor *c );
 
 
 /* hifind - move the current position to a given key
@@ -151,6 +180,24 @@ word  hifree( hicursor *c );
 word  hifind( hicursor *c, ub4 key );
 
 
+/* hifind_many - look up a whole batch of keys
+   ARGUMENTS:
+     t    - a hash table of integers
+     keys - the keys to look for
+     n    - number of keys
+     out  - output, out[i] is the stuff for keys[i], or 0 if it is absent
+   RETURNS:
+     the number of keys that were found
+   NOTE:
+     No cursor is moved.  All keys are hashed and their buckets are
+       prefetched HIWINDOW keys ahead of when they are needed, so the
+       cache misses of many lookups overlap instead of happening one at
+       a time.  For big tables this is much faster than n hifind calls.
+ */
+#define HIWINDOW 16          /* keys in flight in hifind_many, a power of 2 */
+size_t hifind_many( hitab *t, const ub4 *keys, size_t n, void **out );
+
+
 /* hiadd - add a new item to the hash table
           change the position to point at the item with the key
    ARGUMENTS:
@@ -168,8 +215,11 @@ word  hiadd( hicursor *c, ub4 key, void *stuff );
   ARGUMENTS:
     c    - a cursor on a hash table of integers
   RETURNS:
-    FALSE if there is no current item (meaning the table is empty)
+    FALSE if there is no current item (meaning the table is empty), or
+    if another cursor already deleted it
   NOTE:
+    The item is found again by its key, so this works even if another
+    cursor's hiadd grew the table since this cursor was positioned.
     This frees the item, but not the key or stuff stored in the item.
     If you want these then deal with them first.  For example:
       if (hifind(tab, key, keyl))
@@ -207,9 +257,17 @@ word hifirst( hicursor *c );
       while (hinext(c));
  */
 /* word hinext(hicursor *c); */
+#ifdef THREADS
 #define hinext(c) \
   ((!(c)->ipos) ? FALSE :  \
-   ((c)->ipos=(c)->ipos->next) ? TRUE : hinbucket(c->tab))
+   ((c)->ipos=__atomic_load_n(&(c)->ipos->next, __ATOMIC_ACQUIRE)) ? \
+   ((c)->key=(c)->ipos->key, TRUE) : hinbucket(c))
+#else
+#define hinext(c) \
+  ((!(c)->ipos) ? FALSE :  \
+   ((c)->ipos=(c)->ipos->next) ? \
+   ((c)->key=(c)->ipos->key, TRUE) : hinbucket(c))
+#endif
 word    hiprev(hicursor *c);
 
 /* histat - print statistics about the hash table
@@ -230,4 +288,40 @@ word    hiprev(hicursor *c);
  */
 void histat( hicursor *c );
 
+
+/* hienter, hiexit - bracket a read-side critical section
+  ARGUMENTS:
+    c    - a cursor on a hash table of integers
+  NOTE:
+    Only needed when compiled with THREADS, otherwise they do nothing.
+    Positions (ipos) are only meaningful between hienter and hiexit; once
+    the cursor leaves, a writer may recycle the hint it was pointing at.
+    Every hifind, hifirst, hinext and hifind_many done by a thread that
+    does not hold hilock must be inside hienter/hiexit:
+      hienter(c);
+      if (hifind(c, key)) stuff = histuff(c);
+      hiexit(c);
+    A cursor belongs to one thread.  Use hicopy to give each thread its
+    own cursor.
+
+   hilock, hiunlock - bracket a sequence of writes
+  ARGUMENTS:
+    c    - a cursor on a hash table of integers
+  NOTE:
+    hiadd, hidel, hicopy and hifree must be done while holding hilock.
+    A writer does not need hienter; the lock keeps other writers out and
+    readers never free anything.
+ */
+#ifdef THREADS
+void hienter( hicursor *c );
+void hiexit( hicursor *c );
+#define hilock(c)   pthread_mutex_lock(&(c)->tab->wlock)
+#define hiunlock(c) pthread_mutex_unlock(&(c)->tab->wlock)
+#else
+#define hienter(c)
+#define hiexit(c)
+#define hilock(c)
+#define hiunlock(c)
+#endif
+
 #endif   /* HICURSOR */
@@ -10,12 +10,14 @@ jenny.c -- jennyrate tests from m dimensions of features that cover all
   Already-written tests can be piped in to be reused.
 
 Arguments
-  Arguments without a leading '-' : an integer in 2..52.  Represents a
+  Arguments without a leading '-' : an integer in 2..65534.  Represents a
        dimension.  Dimensions are implicitly numbered 1..65535, in the 
        order they appear.  Features in dimensions are always implicitly
-       given 1-character names, which are in order a..z, A..Z .  It's a
-       good idea to pass the output of jenny through a postprocessor that
-       expands these names into something intelligible.
+       given 1-character names, which are in order a..z, A..Z .  A
+       dimension with more than 52 features names every feature with 2
+       letters, aa, ab, ..., ZZ, and one with more than 2704 uses 3.
+       It's a good idea to pass the output of jenny through a
+       postprocessor that expands these names into something intelligible.
 
   -o : old.  -ofoo.txt reads existing tests from the file foo.txt, includes
        those tests in the output, and adds whatever other tests are needed to
@@ -25,14 +27,51 @@ Arguments
        a do-nothing feature in each new dimension, then pad the existing tests
        with do-nothing out to the correct number of dimensions.
 
+  -d : delta.  With -o, the old tests may stop short of the last few
+       dimensions, which must be the new ones.  They are trusted to
+       already cover every tuple of the dimensions they have, so only
+       tuples involving a new dimension are built.  The old tests are
+       extended into the new dimensions first, then new tests cover what
+       is left.  Only tests that are new or were extended are printed.
+
   -h : help.  Print out instructions for using jenny.
 
+  -j : JSON.  Print each test the moment it is made, as a line like
+       {"test":3,"features":{"1":"b","2":"a"},"left":{"1":0,"2":null}}
+       and flush, so whatever runs the tests can start before jenny is
+       done.  "left" is how many tuples of each size are still
+       uncovered, or null while jenny hasn't built them all yet (always,
+       with -d).  Tuples that could not be covered go to stderr.
+
+  -c : CSV.  Like -j, but print a header line of dimension labels and
+       then one line of feature labels per test.  Progress goes to stderr,
+       with ? where -j would say null.
+
+  -l : labels.  -lfoo.txt reads labels for -j and -c from foo.txt.  Line
+       i is dimension i: its label, then its features' labels in order,
+       all separated by spaces.  Missing labels are jenny's own names.
+
   -n : an integer.  Cover all n-tuples of features, one from each dimension.
        Default is 2 (pairs).  3 (triplets) may be reasonable.  4 (quadruplets)
        is definitely overkill.  n > 4 is highly discouraged.
 
+  -r : reduce.  After all tuples are covered, try to drop tests whose
+       tuples other tests can take over with small changes, for at most the
+       given number of seconds.  -r alone spends up to 10 seconds.  Tests
+       from -o are kept as they are.  Since it stops when time runs out,
+       the output of -r can depend on how fast the machine is.
+
   -s : seed.  An integer.  Seed the random number generator.
 
+  -t : threads.  -t4 builds at least 4 candidate tests at once, in 4 threads
+       if compiled with -DTHREADS, and keeps the best.  Each candidate has
+       its own random numbers, so the output of -t4 depends only on the
+       seed, not on timing or on whether THREADS was compiled in.  -t
+       alone uses one thread per CPU with -DTHREADS, but means -t1
+       without it, so its output can differ between the two builds.
+       Without -t, candidates are built one at a time as always.  The final
+       check that every tuple is covered is split among the threads too.
+
   -w : without this combination of features.  A feature is given by a dimension
        number followed by a one-character feature name.  A single -w can
        disallow multiple features in a dimension.  For example, -w1a2cd4ac
@@ -55,15 +94,25 @@ number of testcases required to at least 5*3*3=45.
 #include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#ifdef THREADS
+#include <pthread.h>
+#include <unistd.h>
+#endif
 
 /*
 -------------------------------------------------------------------------------
 Implementation:
 
 Internally, there can be 64K dimensions with 64K features apiece.  Externally,
-the number of features per dimensions is limited to just 52, and are implicitly
-named a..z, A..Z.  Other printable characters, like |, caused trouble in the
-shell when I tried to give them during a without.
+features are implicitly named a..z, A..Z, and dimensions with more than 52
+features use 2 or 3 of those letters for every name, so -w can still tell
+where one name ends.  Other printable characters, like |, caused trouble in
+the shell when I tried to give them during a without.
+
+Finished tests are bit-packed, ceil(log2(features)) bits per dimension, so
+a test of 60 dimensions of 4 takes 16 bytes instead of 120.  The tests
+being built are plain arrays.
 
 The program first finds tests for all features, then adds tests to cover
 all pairs of features, then all triples of features, and so forth up to
@@ -139,6 +188,49 @@ void flearand_init( flearandctx *x, ub4 seed) {
   x->q = 0;
 }
 
+/* fill out[0..n-1] with the next n values flearand would return */
+void flearand_fill( flearandctx *x, ub4 *out, size_t n) {
+  while (n > 0) {
+    ub4 i;
+    if (!x->q) {
+      x->q = FLEARAND_SIZE;
+      flearand_batch(x);
+    }
+    for (i = (n < x->q) ? (ub4)n : x->q; i; --i, --n) {
+      *out++ = x->r[--x->q];
+    }
+  }
+}
+
+/*
+ * Scale the low 32 bits of a random value r to 0..n-1, n > 0, by
+ * multiplying and keeping the high word (Lemire), which needs no division.
+ * The few r that would make some results more likely than others are
+ * thrown back for another.
+ */
+#define FLEA_LOW(r) ((ub8)(r) & 0xffffffff)
+ub4 flearand_scale( flearandctx *x, ub4 r, ub4 n) {
+  ub8 m = FLEA_LOW(r) * n;
+  if (FLEA_LOW(m) < n) {
+    ub8 least = ((((ub8)1) << 32) - n) % n;
+    while (FLEA_LOW(m) < least) {
+      m = FLEA_LOW(flearand(x)) * n;
+    }
+  }
+  return (ub4)(m >> 32);
+}
+
+/* a random number in 0..n-1, n > 0 */
+ub4 flearand_range( flearandctx *x, ub4 n) {
+  return flearand_scale(x, flearand(x), n);
+}
+
+/* a 64-bit random number, from the low 32 bits of two results */
+ub8 flearand64( flearandctx *x) {
+  ub8 high = FLEA_LOW(flearand(x));
+  return (high << 32) | FLEA_LOW(flearand(x));
+}
+
 
 
 
@@ -184,11 +276,23 @@ Stuff specific to jenny
 ------------------------------------------------------------------------------
 */
 
-#define MAX_FEATURES 52                  /* can't name more than 52 features */
-#define MAX_TESTS    65534         /* arbitrary limit on number of testcases */
+#define FEATURE_LETTERS 52             /* letters to name features with */
+#define MAX_FEATURES 65534        /* 3-letter names, and (ub2)~0 is no feature */
+#define MAX_TESTS    0x7fffffff    /* arbitrary limit on number of testcases */
 #define MAX_N        32       /* never can do complete coverage of 33-tuples */
-#define MAX_WITHOUT  (MAX_FEATURES*MAX_N)       /* max features in a without */
+#define MAX_WITHOUT  65536                      /* max features in a without */
 #define MAX_DIMENSIONS (((ub2)~0)-1) /* More than 64K dimensions needs a ub4 */
+#define BITSET_WORDS (1<<16)    /* most ub8s in the tuple bitset of a feature */
+#define GROUP_SIZE   5            /* candidate tests to build for each test */
+#define MAX_THREADS  256                                /* most threads for -t */
+#define REDUCE_SECONDS 10                      /* time -r alone spends reducing */
+#define OUT_JENNY    0                       /* print all tests at the end */
+#define OUT_JSON     1                 /* -j, stream tests as JSON lines */
+#define OUT_CSV      2                        /* -c, stream tests as CSV */
+
+/* letters in every feature name of a dimension with n features */
+#define NAME_WIDTH(n) ((n) <= FEATURE_LETTERS ? 1 : \
+		       (n) <= FEATURE_LETTERS*FEATURE_LETTERS ? 2 : 3)
 
 /* A "test", which is a combination of features.  Prefix t. */
 typedef  struct test {
@@ -198,6 +302,7 @@ typedef  struct test {
 /* representation of a restriction, prefix w */
 typedef  struct without {
   ub2             len;                            /* length of feature array */
+  ub2             ndim;                       /* distinct dimensions in fe */
   struct feature *fe;                                       /* feature array */
 } without;
 
@@ -207,6 +312,21 @@ typedef  struct wchain {
   struct wchain *next;
 } wchain;
 
+/* scratch space for building one candidate test, prefix c */
+typedef  struct climb {
+  flearandctx  *r;                                  /* random number context */
+  flearandctx   own;                 /* r, if this candidate has its own stream */
+  ub2          *dimord;                 /* order in which to choose dimensions */
+  ub8          *tmask;         /* a bit for each slot of the test being scored */
+  test         *t;                                       /* the candidate test */
+  ub4           coverage;      /* tuples t covers, 0 if it could not be built */
+  ub2          *wmatch;  /* wmatch[i] is dimensions of without i that t has */
+  ub4          *whit;     /* whit[d] is disobeyed withouts with dimension d */
+  ub4           nhit;                        /* disobeyed withouts in all */
+  ub2          *best;               /* scratch for the hillclimbers, maxdim */
+  ub4          *draw;            /* scratch for random testcases, ndim */
+} climb;
+
 
 /* Return a count of how many withouts are disobeyed. */
 /* Also set a pointer to a randomly chosen violated without */
@@ -255,24 +375,51 @@ typedef enum token_type {
 typedef  struct state {
   ub1       n_final;           /* The n in the user's n-tuples, default is 2 */
   ub2       ndim;                                    /* number of dimensions */
-  ub2       ntests;                              /* number of testcases in t */
+  ub4       ntests;                              /* number of testcases in t */
+  ub4       maxtests;                        /* testcases t has room for */
   ub1     **n;  /* n[d][f] is current n-tuple size for dimension d feature f */
-  test    **t;                             /* all the tests generated so far */
+  ub8      *t;         /* all the tests so far, packed, twords ub8s apiece */
+  ub4       twords;                         /* ub8s in a packed testcase */
+  ub4      *boff;        /* boff[d] is the first bit of dimension d in a test */
+  ub1      *bwid;                 /* bwid[d] is the bits dimension d takes */
   ub2      *dim;                     /* number of features in each dimension */
   wchain  **wc;                   /* s->wc[d] lists withouts for dimension d */
   wchain   *wc2;                      /* a list of all the original withouts */
   wchain   *wc3;                             /* additional, deduced withouts */
+  without **wall;              /* wall[i] is the i-th without in wc2, or 0 */
+  ub4       nw;                                    /* number of withouts */
+  ub4      *wfirst;  /* wlist[wfirst[slot]..wfirst[slot+1]-1] use that slot */
+  ub4      *wlist;          /* indices into wall, grouped by feature slot */
+  ub2      *wtally;                   /* scratch counts for tuple_withouts */
   tu_arr ***tu;  /* tu[d][f] lists untested tuples for dimension d feature f */
-  tu_arr ***one;
-       /* one[testcase][d] lists tuples with d covered only by this testcase */
-  ub4     **onec;          /* onec[testcase][d] is count of one[testcase][d] */
+  ub8    ***bits;       /* bits[d][f] is tu[d][f] as a bitset, or 0; see below */
+  ub4       nslot;           /* number of features in all dimensions together */
+  ub4      *soff;         /* soff[d] is the slot of the first feature of d */
+  ub4       nword;                        /* ub8s in a bitset row of nslot bits */
+  ub4       bscan[MAX_N+1];       /* bitset rows count_tuples scans for n */
+  ub4     **onec;
+     /* onec[testcase][d] counts tuples with d covered only by this testcase */
+     /* onec and tbits exist only while reducing, see prepare_reduce */
+  ub8    ***tbits;  /* tbits[d][f] is a bitset of the tests having f in d */
+  ub4       tword;                          /* ub8s in a row of tbits */
+  ub4       nold;                /* tests read by -o, which reducing keeps */
+  ub1       delta;           /* -d, trust -o tests and print what changed */
+  ub2       nolddim;     /* with -d, dimensions the -o tests already have */
+  ub4       reduce;               /* -r, seconds to spend reducing, or 0 */
+  ub1       format;               /* OUT_JENNY, or OUT_JSON or OUT_CSV */
+  char     *labels;                   /* the text of the -l file, or 0 */
+  char    **dlabel;          /* dlabel[d] labels dimension d, or 0 */
+  char   ***flabel;        /* flabel[d][f] labels feature f of d, or 0 */
   ub4     **used;
    /* used[testcase][d] = pass# if this pass has already explored test[t][d] */
   ub4     **tc;   /* tc[d][f] is # untested tulpes for dimension d feature f */
   test     *tuple_tester;   /* an all -1 test used to test individual tuples */
-  ub2      *dimord;                   /* order in which to choose dimensions */
   ub2      *featord;                    /* order in which to choose features */
   flearandctx   r;                                  /* random number context */
+  climb    *c;     /* c[i] builds candidate i; without -t, only c[0], using r */
+  ub2       maxdim;                        /* features in the largest dimension */
+  ub2       nthreads;              /* -t, threads building candidates, or 0 */
+  ub2       ngroup;                   /* candidates in c[], GROUP_SIZE or more */
 } state;
 
 
@@ -292,23 +439,61 @@ void truncate_tuple( tu_arr **tu, ub4 *count)
   *count = 0;
 }
 
+/* feature of dimension d in test i */
+static ub2 get_feature( state *s, ub4 i, ub4 d)
+{
+  ub8 x = s->t[(size_t)i*s->twords + s->boff[d]/64] >> (s->boff[d]%64);
+  return (ub2)(x & (((ub8)1 << s->bwid[d]) - 1));
+}
+
+/* set the feature of dimension d in test i to f */
+static void put_feature( state *s, ub4 i, ub4 d, ub2 f)
+{
+  ub8 *x = &s->t[(size_t)i*s->twords + s->boff[d]/64];
+  ub8  mask = (((ub8)1 << s->bwid[d]) - 1) << (s->boff[d]%64);
+  *x = (*x & ~mask) | ((ub8)f << (s->boff[d]%64));
+}
+
+/* copy the features of test i into t */
+static void get_test( state *s, ub4 i, test *t)
+{
+  ub4 d;
+  for (d=0; d<s->ndim; ++d) {
+    t->f[d] = get_feature(s, i, d);
+  }
+}
+
 /* delete the i-th test */
 void delete_test( state *s, ub4 i)
 {
-  test *t = s->t[i];
+  --s->ntests;
+  memcpy(&s->t[(size_t)i*s->twords], &s->t[(size_t)s->ntests*s->twords],
+	 sizeof(ub8)*s->twords);
+}
 
-  s->t[i] = s->t[--s->ntests];
-  my_free((char *)t->f);
-  my_free((char *)t);
-  if (s->one[s->ntests]) {
-    ub2   d;
+/* free onec and tbits, which only reducing uses */
+void free_reduce( state *s)
+{
+  if (s->onec) {
+    ub4 t;
+    for (t=0; t<s->ntests; ++t) {
+      if (s->onec[t]) my_free((char *)s->onec[t]);
+    }
+    my_free((char *)s->onec);
+    s->onec = (ub4 **)0;
+  }
+  if (s->tbits) {
+    ub2 d,f;
     for (d=0; d<s->ndim; ++d) {
-      truncate_tuple(&s->one[s->ntests][d], &s->onec[s->ntests][d]);
+      if (s->tbits[d]) {
+	for (f=0; f<s->dim[d]; ++f) {
+	  if (s->tbits[d][f]) my_free((char *)s->tbits[d][f]);
+	}
+	my_free((char *)s->tbits[d]);
+      }
     }
-    my_free((char *)s->one[s->ntests]);
-    my_free((char *)s->onec[s->ntests]);
-    s->one[s->ntests]  = (tu_arr **)0;
-    s->onec[s->ntests] = (ub4 *)0;
+    my_free((char *)s->tbits);
+    s->tbits = (ub8 ***)0;
   }
 }
 
@@ -327,6 +512,37 @@ void cleanup(state *s)
     my_free((char *)s->tu);
   }
 
+  if (s->bits) {
+    ub2 d,f;
+    for (d=0; d<s->ndim; ++d) {
+      if (s->bits[d]) {
+	for (f=0; f<s->dim[d]; ++f) {
+	  if (s->bits[d][f]) my_free((char *)s->bits[d][f]);
+	}
+	my_free((char *)s->bits[d]);
+      }
+    }
+    my_free((char *)s->bits);
+  }
+  if (s->soff) my_free((char *)s->soff);
+
+  if (s->c) {
+    ub2 i;
+    for (i=0; i<s->ngroup; ++i) {
+      if (s->c[i].dimord) my_free((char *)s->c[i].dimord);
+      if (s->c[i].tmask) my_free((char *)s->c[i].tmask);
+      if (s->c[i].wmatch) my_free((char *)s->c[i].wmatch);
+      if (s->c[i].whit) my_free((char *)s->c[i].whit);
+      if (s->c[i].best) my_free((char *)s->c[i].best);
+      if (s->c[i].draw) my_free((char *)s->c[i].draw);
+      if (s->c[i].t) {
+	if (s->c[i].t->f) my_free((char *)s->c[i].t->f);
+	my_free((char *)s->c[i].t);
+      }
+    }
+    my_free((char *)s->c);
+  }
+
   /* free n, the tuple lengths */
   if (s->n) {
     ub2 d;
@@ -349,6 +565,11 @@ void cleanup(state *s)
     my_free((char *)s->tc);
   }
 
+  if (s->wall) my_free((char *)s->wall);
+  if (s->wfirst) my_free((char *)s->wfirst);
+  if (s->wlist) my_free((char *)s->wlist);
+  if (s->wtally) my_free((char *)s->wtally);
+
   /* free the secondary chains of restrictions */
   if (s->wc) {
     ub2 i;
@@ -381,20 +602,11 @@ void cleanup(state *s)
     my_free((char *)wc);
   }
 
-  if (s->t) {
-    while (s->ntests) {
-      delete_test(s, 0);
-    }
-    my_free((char *)s->t);
-  }
-
-  if (s->one) {
-    my_free((char *)s->one);
-  }
+  free_reduce(s);
 
-  if (s->onec) {
-    my_free((char *)s->onec);
-  }
+  if (s->t) my_free((char *)s->t);
+  if (s->boff) my_free((char *)s->boff);
+  if (s->bwid) my_free((char *)s->bwid);
 
   if (s->tuple_tester) {
     if (s->tuple_tester->f) {
@@ -403,14 +615,20 @@ void cleanup(state *s)
     my_free((char *)s->tuple_tester);
   }
 
-  if (s->dimord) {
-    my_free((char *)s->dimord);
-  }
-
   if (s->featord) {
     my_free((char *)s->featord);
   }
 
+  if (s->flabel) {
+    ub2 d;
+    for (d=0; d<s->ndim; ++d) {
+      if (s->flabel[d]) my_free((char *)s->flabel[d]);
+    }
+    my_free((char *)s->flabel);
+  }
+  if (s->dlabel) my_free((char *)s->dlabel);
+  if (s->labels) my_free(s->labels);
+
   /* free the array of dimension lengths */
   if (s->dim) my_free((char *)s->dim);
 }
@@ -457,13 +675,33 @@ int insert_tuple( state *s, tu_iter *ctx, feature *tuple)
 }
 
 /* print out a single tuple */
-void show_tuple( feature *fe, ub2 len)
+/* write the name of feature f of dimension d, NAME_WIDTH letters, to name */
+void name_feature( state *s, ub4 d, ub4 f, char *name)
 {
-  ub4 i;
+  sb4 i = NAME_WIDTH(s->dim[d]);
+
+  name[i] = '\0';
+  while (i-- > 0) {
+    name[i] = feature_name[f % FEATURE_LETTERS];
+    f /= FEATURE_LETTERS;
+  }
+}
+
+void show_tuple( FILE *out, state *s, feature *fe, ub2 len)
+{
+  ub4  i;
+  char name[4];
   for (i=0; i<len; ++i) {
-    printf(" %d%c", fe[i].d+1, feature_name[fe[i].f]);
+    name_feature(s, fe[i].d, fe[i].f, name);
+    fprintf(out, " %d%s", fe[i].d+1, name);
   }
-  printf(" \n");
+  fprintf(out, " \n");
+}
+
+/* where messages go: stdout, unless stdout is a stream of -j or -c tests */
+FILE *note_file( state *s)
+{
+  return (s->format == OUT_JENNY) ? stdout : stderr;
 }
 
 /* delete a tuple from a tuple array */
@@ -571,38 +809,66 @@ void initialize( state *s)
   s->wc           = (wchain **)0;
   s->wc2          = (wchain *)0;
   s->wc3          = (wchain *)0;
+  s->wall         = (without **)0;
+  s->wfirst       = (ub4 *)0;
+  s->wlist        = (ub4 *)0;
+  s->wtally       = (ub2 *)0;
   s->tu           = (tu_arr ***)0;
-  s->one          = (tu_arr ***)0;
+  s->bits         = (ub8 ***)0;
+  s->soff         = (ub4 *)0;
+  s->c            = (climb *)0;
   s->onec         = (ub4 **)0;
+  s->tbits        = (ub8 ***)0;
   s->n            = (ub1 **)0;
   s->tc           = (ub4 **)0;
-  s->t            = (test **)0;
+  s->t            = (ub8 *)0;
+  s->boff         = (ub4 *)0;
+  s->bwid         = (ub1 *)0;
   s->tuple_tester = (test *)0;
-  s->dimord       = (ub2 *)0;
   s->featord      = (ub2 *)0;
 
   /* fill in default values */
   s->ndim = (ub2)0;
   s->n_final = 2;     /* guarantees that all pairs of dimensions are covered */
   s->ntests = 0;
+  s->maxtests = 0;
+  s->nw = 0;
+  s->nthreads = 0;
+  s->ngroup = 0;
+  s->nold = 0;
+  s->delta = FALSE;
+  s->nolddim = 0;
+  s->reduce = 0;
+  s->format = OUT_JENNY;
+  s->labels = (char *)0;
+  s->dlabel = (char **)0;
+  s->flabel = (char ***)0;
   flearand_init(&s->r, 0);             /* initialize random number generator */
 }
 
 
-/* add one test to the list of tests */
+/* add a copy of one test to the list of tests */
 int add_test( state *s, test *t)
 {
-  ub4 i;
+  ub4 d;
   if (s->ntests == MAX_TESTS) {
     return FALSE;
   }
-  s->one[s->ntests] = (tu_arr **)my_alloc(s, sizeof(tu_arr *)*s->ndim);
-  s->onec[s->ntests] = (ub4 *)my_alloc(s, sizeof(ub4)*s->ndim);
-  for (i=0; i<s->ndim; ++i) {
-    s->one[s->ntests][i] = (tu_arr *)0;
-    s->onec[s->ntests][i] = 0;
+  if (s->ntests == s->maxtests) {                  /* double the room for t */
+    ub4  more = (s->maxtests < MAX_TESTS/2) ? 2*s->maxtests+64 : MAX_TESTS;
+    ub8 *t2 = (ub8 *)my_alloc(s, sizeof(ub8)*s->twords*(size_t)more);
+    if (s->t) {
+      memcpy(t2, s->t, sizeof(ub8)*s->twords*(size_t)s->ntests);
+      my_free((char *)s->t);
+    }
+    s->t = t2;
+    s->maxtests = more;
+  }
+  memset(&s->t[(size_t)s->ntests*s->twords], 0, sizeof(ub8)*s->twords);
+  for (d=0; d<s->ndim; ++d) {
+    put_feature(s, s->ntests, d, t->f[d]);
   }
-  s->t[s->ntests++] = t;
+  ++s->ntests;
   return TRUE;
 }
 
@@ -646,10 +912,10 @@ token_type parse_token(char *inp, ub4 inl, ub4 *curr, ub4 *rsl)
 	     (mychar >= 'A' && mychar <= 'Z')) {
     /*------------------------------------------------- parse a feature name */
     ub4 i;
-    for (i=0; i<MAX_FEATURES; ++i)
+    for (i=0; i<FEATURE_LETTERS; ++i)
       if (feature_name[i] == mychar)
 	break;
-    if (i == MAX_FEATURES) {
+    if (i == FEATURE_LETTERS) {
       printf("jenny: the name '%c' is not used for any feature\n",
 	     mychar);
 	return TOKEN_ERROR;
@@ -662,7 +928,23 @@ token_type parse_token(char *inp, ub4 inl, ub4 *curr, ub4 *rsl)
   }
 }
 
-#define BUFSIZE (MAX_DIMENSIONS*7+2)
+/*
+ * Finish parsing a feature name of dimension d, whose first letter was
+ * just parsed into *value.  Names in big dimensions take more letters.
+ */
+int parse_name( state *s, ub4 d, char *inp, ub4 inl, ub4 *curr, ub4 *value)
+{
+  ub4 i, letter;
+  for (i=1; i<NAME_WIDTH(s->dim[d]); ++i) {
+    if (parse_token(inp, inl, curr, &letter) != TOKEN_FEATURE) {
+      return FALSE;
+    }
+    *value = *value*FEATURE_LETTERS + letter;
+  }
+  return TRUE;
+}
+
+#define BUFSIZE (MAX_DIMENSIONS*9+2)
 /* load old tests before generating new ones */
 int load( state *s, char *testfile)
 {
@@ -685,20 +967,24 @@ int load( state *s, char *testfile)
     ub4   value;                                              /* token value */
     token_type token;                                          /* token type */
     ub4   i;
-    test *t;
-
-    t = (test *)my_alloc( s, sizeof(test));
-    t->f = (ub2 *)my_alloc( s, sizeof(ub2)*s->ndim);
-    if (!add_test(s, t)) {
-      goto failure;
-    }
+    test *t = s->c[0].t;                 /* scratch, add_test copies it */
+    char  name[4];
 
     for (i=0; i<s->ndim; ++i) {
       if (parse_token(buf, UB4MAXVAL, &curr, &value) != TOKEN_SPACE) {
 	printf("jenny: -o, non-space found where space expected\n");
 	goto failure;
       }
-      if (parse_token(buf, UB4MAXVAL, &curr, &value) != TOKEN_NUMBER) {
+      token = parse_token(buf, UB4MAXVAL, &curr, &value);
+      if (token == TOKEN_END && s->delta && i > 0) {
+	if (s->nolddim != 0 && s->nolddim != i) {
+	  printf("jenny: -o, old testcases have different lengths\n");
+	  goto failure;
+	}
+	s->nolddim = i;                /* -d, dimensions i.. are new ones */
+	break;
+      }
+      if (token != TOKEN_NUMBER) {
 	printf("jenny: -o, non-number found where number expected\n");
 	goto failure;
       }
@@ -706,31 +992,50 @@ int load( state *s, char *testfile)
 	printf("jenny: -o, number %d found out-of-place\n", value);
 	goto failure;
       }
-      if (parse_token(buf, UB4MAXVAL, &curr, &value) != TOKEN_FEATURE) {
+      if (parse_token(buf, UB4MAXVAL, &curr, &value) != TOKEN_FEATURE ||
+	  !parse_name(s, i, buf, UB4MAXVAL, &curr, &value)) {
 	printf("jenny: -o, non-feature found where feature expected\n");
 	goto failure;
       }
       if (value >= s->dim[i]) {
-	printf("jenny: -o, feature %c does not exist in dimension %d\n", 
-	       feature_name[value], i+1);
+	name_feature(s, i, value, name);
+	printf("jenny: -o, feature %s does not exist in dimension %d\n", 
+	       name, (int)i+1);
 	goto failure;
       }
       t->f[i] = value;
     }
-    if (parse_token(buf, UB4MAXVAL, &curr, &value) != TOKEN_SPACE) {
-      printf("jenny: -o, non-space found where trailing space expected\n");
-      goto failure;
-    }
-    if (parse_token(buf, UB4MAXVAL, &curr, &value) != TOKEN_END) {
-      printf("jenny: -o, testcase not properly terminated\n");
-      goto failure;
+    if (i == s->ndim) {
+      if (s->delta && s->nolddim != 0 && s->nolddim != i) {
+	printf("jenny: -o, old testcases have different lengths\n");
+	goto failure;
+      }
+      s->nolddim = i;
+      if (parse_token(buf, UB4MAXVAL, &curr, &value) != TOKEN_SPACE) {
+	printf("jenny: -o, non-space found where trailing space expected\n");
+	goto failure;
+      }
+      if (parse_token(buf, UB4MAXVAL, &curr, &value) != TOKEN_END) {
+	printf("jenny: -o, testcase not properly terminated\n");
+	goto failure;
+      }
     }
 
-    /* make sure the testcase obeys all the withouts */
+    /* make sure the testcase obeys all the withouts, new dimensions empty */
+    for (; i<s->ndim; ++i) {
+      t->f[i] = (ub2)~0;
+    }
     if (count_withouts(t, s->wc2)) {
       printf("jenny: -o, old testcase contains some without\n");
       goto failure;
     }
+    for (i=s->nolddim; i<s->ndim; ++i) {
+      t->f[i] = 0;                        /* until extend_tests fills it */
+    }
+    if (!add_test(s, t)) {
+      printf("jenny: -o, more than %ld testcases\n", (ub4)MAX_TESTS);
+      goto failure;
+    }
   }
 
   (void)fclose(f);
@@ -751,6 +1056,8 @@ static const sb1 *jenny_doc[] = {
   "  dimension with 6 features.  The type of the left-hand argument is\n",
   "  another dimension.  Dimensions are numbered 1..65535, in the order\n",
   "  they are listed.  Features are implicitly named a..z, A..Z.\n",
+  "  Dimensions of more than 52 features name each one with 2 letters\n",
+  "  (aa..ZZ), and of more than 2704 features with 3 letters.\n",
   "   3 Dimensions are given by the number of features in that dimension.\n",
   "  -h prints out these instructions.\n",
   "  -n specifies the n in n-tuple.  The default is 2 (meaning pairs).\n",
@@ -758,6 +1065,19 @@ static const sb1 *jenny_doc[] = {
   "     of the first dimension with the first or second feature of the\n",
   "     fourth dimension is disallowed.\n",
   "  -ofoo.txt reads old jenny testcases from file foo.txt and extends them.",
+  "\n",
+  "  -d with -o takes the old testcases as complete for the dimensions\n",
+  "     they have, fills in the dimensions added since, and prints only\n",
+  "     the testcases that are new or were extended.\n",
+  "  -j or -c streams each testcase as a JSON line or a CSV row as soon\n",
+  "     as it is made.  -lfoo.txt reads labels from foo.txt, a line per\n",
+  "     dimension: its label, then its features' labels.\n",
+  "  -t4 builds 4 candidate tests at once (in threads if compiled with\n",
+  "     -DTHREADS) and keeps the best.  -t alone uses one per CPU,\n",
+  "     or 1 if not compiled with -DTHREADS.",
+  "\n",
+  "  -r30 spends up to 30 seconds dropping tests other tests can cover.\n",
+  "     -r alone spends up to 10 seconds.",
   "\n\n",
   "  The output is a testcase per line, one feature per dimension per\n",
   "  testcase, followed by the list of all allowed tuples that jenny could\n",
@@ -809,7 +1129,7 @@ int parse_w( state *s, sb1 *myarg)
 {
   without   *w;
   wchain    *wc;
-  feature    fe[MAX_WITHOUT];
+  static feature fe[MAX_WITHOUT];               /* too big for the stack */
   ub1        used[MAX_DIMENSIONS];
   ub4        dimension_number;
   ub4        curr = 0;
@@ -843,7 +1163,7 @@ int parse_w( state *s, sb1 *myarg)
   
   
   switch (parse_token(myarg, len, &curr, &value)) {
-  case TOKEN_FEATURE: goto feature;
+  case TOKEN_FEATURE: goto name;
   case TOKEN_END:
     printf("jenny: -w, withouts must follow numbers with features\n");
     return FALSE;
@@ -853,10 +1173,17 @@ int parse_w( state *s, sb1 *myarg)
     return FALSE;
   }
   
- feature:
+ name:
+  if (!parse_name(s, dimension_number, myarg, len, &curr, &value)) {
+    printf("jenny: -w, features of dimension %d have %d-letter names\n",
+	   (int)dimension_number+1, (int)NAME_WIDTH(s->dim[dimension_number]));
+    return FALSE;
+  }
   if (value >= s->dim[dimension_number]) {
-    printf("jenny: -w, there is no feature '%c' in dimension %d\n",
-	   feature_name[value], dimension_number+1);
+    char name[4];
+    name_feature(s, dimension_number, value, name);
+    printf("jenny: -w, there is no feature '%s' in dimension %d\n",
+	   name, (int)dimension_number+1);
     return FALSE;
   }
   fe[fe_len].d = dimension_number;
@@ -869,7 +1196,7 @@ int parse_w( state *s, sb1 *myarg)
 
   
   switch (parse_token(myarg, len, &curr, &value)) {
-  case TOKEN_FEATURE: goto feature;
+  case TOKEN_FEATURE: goto name;
   case TOKEN_NUMBER: goto number;
   case TOKEN_END: goto end;
   default:
@@ -930,42 +1257,212 @@ int parse_s( state *s, sb1 *myarg)
   return TRUE;
 }
 
+/* parse -r, seconds to spend reducing the tests */
+int parse_r( state *s, sb1 *myarg)
+{
+  ub4 seconds = REDUCE_SECONDS;
+  ub4 dummy = 0;
+  ub4 curr = 0;
+  token_type token = parse_token( myarg, UB4MAXVAL, &curr, &seconds);
+
+  if (token != TOKEN_END &&                      /* -r, REDUCE_SECONDS */
+      (token != TOKEN_NUMBER ||
+       parse_token( myarg, UB4MAXVAL, &curr, &dummy) != TOKEN_END)) {
+    printf("jenny: -r should give just an integer, example -r30\n");
+    return FALSE;
+  }
+  if (seconds < 1) {
+    printf("jenny: -r must be at least 1 second\n");
+    return FALSE;
+  }
+  s->reduce = seconds;
+  return TRUE;
+}
+
+/* parse -t, the number of threads building candidate tests */
+int parse_t( state *s, sb1 *myarg)
+{
+  ub4 nthreads = 0;
+  ub4 dummy = 0;
+  ub4 curr = 0;
+  token_type token = parse_token( myarg, UB4MAXVAL, &curr, &nthreads);
+
+  if (token == TOKEN_END) {                            /* -t, one per CPU */
+    nthreads = 1;
+#ifdef THREADS
+    {
+      long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+      if (ncpu > 1) nthreads = (ub4)ncpu;
+    }
+#endif
+  } else if (token != TOKEN_NUMBER ||
+	     parse_token( myarg, UB4MAXVAL, &curr, &dummy) != TOKEN_END) {
+    printf("jenny: -t should give just an integer, example -t4\n");
+    return FALSE;
+  }
+  if (nthreads < 1 || nthreads > MAX_THREADS) {
+    printf("jenny: -t must be in 1..%d\n", MAX_THREADS);
+    return FALSE;
+  }
+  s->nthreads = (ub2)nthreads;
+  return TRUE;
+}
+
+/*
+ * -l: read labels from a file.  Line d is the label of dimension d
+ * followed by the labels of its features, separated by whitespace.  The
+ * whole file is kept in s->labels and the labels point into it.
+ */
+int load_labels( state *s, char *labelfile)
+{
+  FILE  *f;
+  size_t len = 0;
+  size_t room = BUFSIZE;
+  char  *p;
+  ub2    d;
+
+  f = (labelfile[0] == '\0') ? stdin : fopen(labelfile, "r");
+  if (!f) {
+    printf("jenny: file %s could not be opened\n", labelfile);
+    return FALSE;
+  }
+  s->labels = my_alloc( s, room+1);
+  for (;;) {
+    len += fread(s->labels+len, 1, room-len, f);
+    if (len < room)
+      break;
+    p = my_alloc( s, 2*room+1);
+    memcpy(p, s->labels, len);
+    my_free(s->labels);
+    s->labels = p;
+    room *= 2;
+  }
+  if (f != stdin)
+    (void)fclose(f);
+  s->labels[len] = '\0';
+
+  s->dlabel = (char **)my_alloc( s, sizeof(char *)*s->ndim);
+  s->flabel = (char ***)my_alloc( s, sizeof(char **)*s->ndim);
+  for (d=0; d<s->ndim; ++d) {
+    s->dlabel[d] = (char *)0;
+    s->flabel[d] = (char **)my_alloc( s, sizeof(char *)*s->dim[d]);
+    memset(s->flabel[d], 0, sizeof(char *)*s->dim[d]);
+  }
+
+  /* split each line into words, in place */
+  for (p=s->labels, d=0; p && d<s->ndim; ++d) {
+    char *next = strchr(p, '\n');
+    char *word;
+    ub4   f = 0;
+
+    if (next) *next++ = '\0';
+    for (word = strtok(p, " \t\r"); word; word = strtok((char *)0, " \t\r")) {
+      if (f == 0) {
+	s->dlabel[d] = word;
+      } else if (f <= s->dim[d]) {
+	s->flabel[d][f-1] = word;
+      } else {
+	printf("jenny: -l, dimension %d has only %d features\n",
+	       d+1, s->dim[d]);
+	return FALSE;
+      }
+      ++f;
+    }
+    p = next;
+  }
+  return TRUE;
+}
+
 void preliminary( state *s)
 {
   wchain  *wc;
   ub4      d;
+  ub4      temp;
 
   s->tuple_tester = (test *)my_alloc( s, sizeof(test));
   s->tuple_tester->f = (ub2 *)my_alloc( s, sizeof(ub2)*s->ndim);
-  s->dimord  = (ub2 *)my_alloc( s, sizeof(ub2)*s->ndim);
   s->wc = (wchain **)my_alloc( s, sizeof(wchain *)*s->ndim);
   s->tu = (tu_arr ***)my_alloc( s, sizeof(tu_arr **)*s->ndim);
-  s->one = (tu_arr ***)my_alloc( s, sizeof(tu_arr **)*MAX_TESTS);
+  s->bits = (ub8 ***)my_alloc( s, sizeof(ub8 **)*s->ndim);
+  s->soff = (ub4 *)my_alloc( s, sizeof(ub4)*s->ndim);
   s->n  = (ub1 **)my_alloc( s, sizeof(ub1 *)*s->ndim);
-  s->onec = (ub4 **)my_alloc( s, sizeof(ub4 *)*MAX_TESTS);
   s->tc = (ub4 **)my_alloc( s, sizeof(ub4 *)*s->ndim);
-  s->t  = (test **)my_alloc( s, sizeof(test *)*MAX_TESTS);
+  s->boff = (ub4 *)my_alloc( s, sizeof(ub4)*s->ndim);
+  s->bwid = (ub1 *)my_alloc( s, sizeof(ub1)*s->ndim);
 
   /* initialize to safe values before doing further allocations */
   for (d=0; d<s->ndim; ++d) {
     s->tuple_tester->f[d] = (ub2)~0;
-    s->dimord[d] = (ub2)d;
     s->wc[d] = (wchain *)0;
     s->tu[d] = (tu_arr **)0;
+    s->bits[d] = (ub8 **)0;
     s->n[d] = (ub1 *)0;
     s->tc[d] = (ub4 *)0;
   }
 
   s->featord = (ub2 *)my_alloc( s, sizeof(ub2)*MAX_FEATURES);
 
+  /* number the features of all dimensions as slots 0..nslot-1 */
+  for (s->nslot=0, d=0; d<s->ndim; ++d) {
+    s->soff[d] = s->nslot;
+    s->nslot += s->dim[d];
+  }
+  s->nword = (s->nslot+63)/64;
+
+  /* pack tests in ceil(log2(dim)) bits per dimension, none split by a ub8 */
+  for (s->maxdim=0, s->twords=0, temp=64, d=0; d<s->ndim; ++d) {
+    ub1 bits = 1;
+    while (((ub4)1 << bits) < s->dim[d]) ++bits;
+    if (temp + bits > 64) {
+      ++s->twords;
+      temp = 0;
+    }
+    s->boff[d] = (s->twords-1)*64 + temp;
+    s->bwid[d] = bits;
+    temp += bits;
+    if (s->dim[d] > s->maxdim) s->maxdim = s->dim[d];
+  }
+
+  /* scratch for building candidate tests, one set per candidate with -t */
+  s->ngroup = (s->nthreads == 0) ? 1 : 
+    (s->nthreads < GROUP_SIZE) ? GROUP_SIZE : s->nthreads;
+  s->c = (climb *)my_alloc( s, sizeof(climb)*s->ngroup);
+  for (d=0; d<s->ngroup; ++d) {
+    climb *c = &s->c[d];
+    ub4    i;
+    c->r = (s->nthreads == 0) ? &s->r : &c->own;
+    c->dimord = (ub2 *)my_alloc( s, sizeof(ub2)*s->ndim);
+    for (i=0; i<s->ndim; ++i) {
+      c->dimord[i] = (ub2)i;
+    }
+    c->tmask = (ub8 *)my_alloc( s, sizeof(ub8)*s->nword);
+    c->best = (ub2 *)my_alloc( s, sizeof(ub2)*s->maxdim);
+    c->draw = (ub4 *)my_alloc( s, sizeof(ub4)*s->ndim);
+    c->t = (test *)my_alloc( s, sizeof(test));
+    c->t->f = (ub2 *)my_alloc( s, sizeof(ub2)*s->ndim);
+  }
+
+  /* counting n-tuples scans a row for each n-2 other dimensions */
+  for (d=0; d<=MAX_N; ++d) {
+    ub8 rows = 1;
+    ub4 i;
+    for (i=0; i+2<d; ++i) {
+      rows = rows*(s->ndim-1-i)/(i+1);
+      if (rows > UB4MAXVAL) rows = UB4MAXVAL;
+    }
+    s->bscan[d] = (ub4)rows;
+  }
+
   /* allocate roots for feature-specific lists of uncovered tuples */
   for (d=0; d<s->ndim; ++d) {
     ub2 f;
     s->tu[d] = (tu_arr **)my_alloc( s, sizeof(tu_arr *)*s->dim[d]);
+    s->bits[d] = (ub8 **)my_alloc( s, sizeof(ub8 *)*s->dim[d]);
     s->n[d]  = (ub1 *)my_alloc(s, sizeof(ub1)*s->dim[d]);
     s->tc[d] = (ub4 *)my_alloc(s, sizeof(ub4)*s->dim[d]);
     for (f=0; f<s->dim[d]; ++f) {
       s->tu[d][f] = (tu_arr *)0;
+      s->bits[d][f] = (ub8 *)0;
       s->n[d][f]  = 0;
       s->tc[d][f] = 0;
     }
@@ -983,8 +1480,40 @@ void preliminary( state *s)
 	wcx->next = s->wc[w->fe[i].d];
 	s->wc[w->fe[i].d] = wcx;
 	old = w->fe[i].d;
+	++w->ndim;
       }
     }
+    ++s->nw;
+  }
+
+  /* index the withouts by the feature slots they use, see match_withouts */
+  s->wall = (without **)my_alloc( s, sizeof(without *)*(s->nw+1));
+  s->wfirst = (ub4 *)my_alloc( s, sizeof(ub4)*(s->nslot+1));
+  for (d=0, wc=s->wc2; wc; wc=wc->next) {
+    without *w = wc->w;
+    int      i;
+    s->wall[d++] = w;
+    for (i=0; i<w->len; ++i) {
+      if (i == 0 || w->fe[i].d != w->fe[i-1].d || w->fe[i].f != w->fe[i-1].f)
+	++s->wfirst[s->soff[w->fe[i].d] + w->fe[i].f];
+    }
+  }
+  for (d=1; d<=s->nslot; ++d) {
+    s->wfirst[d] += s->wfirst[d-1];          /* wfirst[slot] is now its end */
+  }
+  s->wlist = (ub4 *)my_alloc( s, sizeof(ub4)*(s->wfirst[s->nslot]+1));
+  s->wtally = (ub2 *)my_alloc( s, sizeof(ub2)*(s->nw+1));
+  for (d=s->nw; d-- > 0;) {
+    without *w = s->wall[d];
+    int      i;
+    for (i=w->len; i-- > 0;) {
+      if (i == 0 || w->fe[i].d != w->fe[i-1].d || w->fe[i].f != w->fe[i-1].f)
+	s->wlist[--s->wfirst[s->soff[w->fe[i].d] + w->fe[i].f]] = d;
+    }
+  }
+  for (d=0; d<s->ngroup; ++d) {
+    s->c[d].wmatch = (ub2 *)my_alloc( s, sizeof(ub2)*(s->nw+1));
+    s->c[d].whit = (ub4 *)my_alloc( s, sizeof(ub4)*s->ndim);
   }
 }
 
@@ -994,9 +1523,10 @@ int parse( int argc, char *argv[], state *s)
   int   i, j;
   ub4   temp;
   char *testfile = (char *)0;
+  char *labelfile = (char *)0;
 
-  /* internal check: we have MAX_FEATURES names for features */
-  if (strlen(feature_name) != MAX_FEATURES) {
+  /* internal check: we have FEATURE_LETTERS names for features */
+  if (strlen(feature_name) != FEATURE_LETTERS) {
     printf("feature_name length is wrong, %d\n", strlen(feature_name));
     return FALSE;
   }
@@ -1056,6 +1586,13 @@ int parse( int argc, char *argv[], state *s)
     case 'o':                               /* -o, file containing old tests */
       testfile = &argv[i][2];
       break;
+    case 'd':                  /* -d, extend the -o tests, print the delta */
+      if (argv[i][2] != '\0') {
+	printf("jenny: -d takes no value\n");
+	return FALSE;
+      }
+      s->delta = TRUE;
+      break;
     case 'n':                       /* -n, get the n of "cover all n-tuples" */
       if (!parse_n( s, &argv[i][2])) return FALSE;
       break;
@@ -1065,8 +1602,30 @@ int parse( int argc, char *argv[], state *s)
     case 's':                           /* -s, "random", change the behavior */
       if (!parse_s( s, &argv[i][2])) return FALSE;
       break;
+    case 'r':                      /* -r, spend some time reducing tests */
+      if (!parse_r( s, &argv[i][2])) return FALSE;
+      break;
+    case 't':                  /* -t, threads building candidate tests at once */
+      if (!parse_t( s, &argv[i][2])) return FALSE;
+      break;
+    case 'j':                           /* -j, stream tests as JSON lines */
+    case 'c':                                   /* -c, stream tests as CSV */
+      if (argv[i][2] != '\0') {
+	printf("jenny: -%c takes no value\n", argv[i][1]);
+	return FALSE;
+      }
+      temp = (argv[i][1] == 'j') ? OUT_JSON : OUT_CSV;
+      if (s->format != OUT_JENNY && s->format != temp) {
+	printf("jenny: -j and -c can't both be given\n");
+	return FALSE;
+      }
+      s->format = (ub1)temp;
+      break;
+    case 'l':                          /* -l, file of labels for -j and -c */
+      labelfile = &argv[i][2];
+      break;
     default:
-      printf("jenny: legal arguments are numbers, -n, -s, -w, -h, not -%c\n",
+      printf("jenny: legal arguments are numbers, -c, -d, -j, -l, -n, -o, -r, -s, -t, -w, -h, not -%c\n",
 	     argv[i][1]);
       return FALSE;
     }
@@ -1078,6 +1637,19 @@ int parse( int argc, char *argv[], state *s)
     return FALSE;
   }
 
+  if (s->format != OUT_JENNY && s->reduce) {
+    printf("jenny: -r can't be used with -j or -c, tests are printed as made\n");
+    return FALSE;
+  }
+  if (labelfile) {
+    if (s->format == OUT_JENNY) {
+      printf("jenny: -l labels the output of -j or -c, give one of those\n");
+      return FALSE;
+    }
+    if (!load_labels( s, labelfile))
+      return FALSE;
+  }
+
   preliminary(s);            /* allocate structures, do preliminary analysis */
 
   /* read in any old tests so we can build from that base */
@@ -1085,83 +1657,430 @@ int parse( int argc, char *argv[], state *s)
     if (!load( s, testfile)) {
       return FALSE;
     }
+    s->nold = s->ntests;
+  } else if (s->delta) {
+    printf("jenny: -d needs old testcases from -o\n");
+    return FALSE;
   }
 
   return TRUE;
 }
 
 /* print out a single test */
-void report( test *t, ub2 len)
+void report( state *s, test *t)
 {
-  ub4 i;
-  for (i=0; i<len; ++i) {
-    printf(" %d%c", i+1, feature_name[t->f[i]]);
+  ub4  i;
+  char name[4];
+  for (i=0; i<s->ndim; ++i) {
+    name_feature(s, i, t->f[i], name);
+    printf(" %d%s", i+1, name);
   }
   printf(" \n");
 }
 
-/* print out all the tests */
+/* print out all the tests, or with -d only those that are new or extended */
 void report_all( state *s)
 {
   ub4   i;
-  for (i=0; i<s->ntests; ++i) {
-    report(s->t[i], s->ndim);
+  i = (s->delta && s->nolddim == s->ndim) ? s->nold : 0;
+  for (; i<s->ntests; ++i) {
+    get_test(s, i, s->c[0].t);
+    report(s, s->c[0].t);
   }
 }
 
+/* print a string as a JSON string */
+static void json_string( char *str)
+{
+  putchar('"');
+  for (; *str; ++str) {
+    ub1 c = (ub1)*str;
+    if (c == '"' || c == '\\')
+      printf("\\%c", c);
+    else if (c < 0x20)
+      printf("\\u%04x", c);
+    else
+      putchar(c);
+  }
+  putchar('"');
+}
 
-void start_builder( state *s, feature *tuple, ub1 n)
+/* print a CSV field, quoted if it has to be */
+static void csv_field( char *str)
 {
-  ub1 i;
-  for (i=0; i<n; ++i) {
-    tuple[i].d = i;
-    tuple[i].f = 0;
+  if (!strpbrk(str, ",\"")) {
+    fputs(str, stdout);
+    return;
   }
+  putchar('"');
+  for (; *str; ++str) {
+    if (*str == '"')
+      putchar('"');
+    putchar(*str);
+  }
+  putchar('"');
 }
 
-int next_builder( state *s, feature *tuple, ub1 n)
+/* the label of dimension d, from -l or else its number */
+static char *dim_label( state *s, ub2 d, char *buf)
 {
-  sb4 i = n;
+  if (s->dlabel && s->dlabel[d])
+    return s->dlabel[d];
+  sprintf(buf, "%d", d+1);
+  return buf;
+}
 
-  while (i-- &&
-	 tuple[i].d == s->ndim-n+i &&
-	 tuple[i].f == s->dim[tuple[i].d]-1)
-    ;
-  if (i == -1)
+/* the label of feature f of dimension d, from -l or else its name */
+static char *feature_label( state *s, ub2 d, ub2 f, char *buf)
+{
+  if (s->flabel && s->flabel[d][f])
+    return s->flabel[d][f];
+  name_feature(s, d, f, buf);
+  return buf;
+}
+
+/*
+ * How many n-tuples are still uncovered, or FALSE if that isn't known.
+ * A feature lists its n-tuples only once it reaches size n, and moves
+ * past n only when its list is empty.  So once every feature has
+ * reached n, each uncovered n-tuple is listed under all n of its
+ * features and the count is exact.  Before that it isn't, and with -d
+ * tuples are listed only under their new dimensions, so it never is.
+ */
+static int tuples_left( state *s, ub1 n, ub8 *left)
+{
+  ub8 sum = 0;
+  ub2 d, f;
+  if (s->delta)
     return FALSE;
-  else if (tuple[i].f < s->dim[tuple[i].d]-1) {
-    ++tuple[i].f;                                       /* increment feature */
-    for (i; i<n-1; ++i) {            /* reset all less significant positions */
-      tuple[i+1].d = tuple[i].d+1;
-      tuple[i+1].f = 0;
-    }
-  }
-  else {
-    ++tuple[i].d;      /* increment least significant non-maxed-out position */
-    tuple[i].f = (ub2)0;                                /* reset its feature */
-    for (i; i<n-1; ++i) {            /* reset all less significant positions */
-      tuple[i+1].d = tuple[i].d+1;
-      tuple[i+1].f = 0;
+  for (d=0; d<s->ndim; ++d) {
+    for (f=0; f<s->dim[d]; ++f) {
+      if (s->n[d][f] < n)
+	return FALSE;
+      if (s->n[d][f] == n)
+	sum += s->tc[d][f];
     }
   }
+  *left = sum / n;
   return TRUE;
 }
 
-
-void build_tuples( state *s, ub2 d, ub2 f)
+/* -j or -c: print test number i as soon as it is made, and flush */
+void emit_test( state *s, test *t, ub4 i)
 {
-  feature  offset[MAX_N];                                      /* n-1-tuples */
-  feature  tuple[MAX_N];                      /* n-tuples that include (d,f) */
-  sb4      i, j, n = s->n[d][f];
-  ub8      count = 0;
-  test    *t;
-  tu_iter  ctx;
+  char buf[12];
+  ub2  d;
+  ub1  n;
+  ub8  left;
 
-  if (s->tc[d][f] > 0 || s->n[d][f] == s->n_final) {
+  if (s->format == OUT_JSON) {
+    printf("{\"test\":%lu,\"features\":{", (unsigned long)i);
+    for (d=0; d<s->ndim; ++d) {
+      if (d) putchar(',');
+      json_string(dim_label(s, d, buf));
+      putchar(':');
+      json_string(feature_label(s, d, t->f[d], buf));
+    }
+    printf("},\"left\":{");
+    for (n=1; n<=s->n_final; ++n) {
+      printf("%s\"%d\":", (n>1) ? "," : "", n);
+      if (tuples_left(s, n, &left))
+	printf("%llu", (unsigned long long)left);
+      else
+	printf("null");
+    }
+    printf("}}\n");
+  } else {
+    for (d=0; d<s->ndim; ++d) {
+      if (d) putchar(',');
+      csv_field(feature_label(s, d, t->f[d], buf));
+    }
+    putchar('\n');
+    fprintf(stderr, "jenny: test %lu, left", (unsigned long)i);
+    for (n=1; n<=s->n_final; ++n) {
+      if (tuples_left(s, n, &left))
+	fprintf(stderr, " %d:%llu", n, (unsigned long long)left);
+      else
+	fprintf(stderr, " %d:?", n);
+    }
+    fprintf(stderr, "\n");
+  }
+  fflush(stdout);
+}
+
+/* -j or -c: print the CSV header, then the -o tests (with -d, only the
+   ones that were extended) */
+void emit_old( state *s)
+{
+  char buf[12];
+  ub2  d;
+  ub4  i;
+
+  if (s->format == OUT_CSV) {
+    for (d=0; d<s->ndim; ++d) {
+      if (d) putchar(',');
+      csv_field(dim_label(s, d, buf));
+    }
+    putchar('\n');
+    fflush(stdout);
+  }
+  i = (s->delta && s->nolddim == s->ndim) ? s->nold : 0;
+  for (; i<s->nold; ++i) {
+    get_test(s, i, s->c[0].t);
+    emit_test(s, s->c[0].t, i+1);
+  }
+}
+
+
+void start_builder( state *s, feature *tuple, ub1 n)
+{
+  ub1 i;
+  for (i=0; i<n; ++i) {
+    tuple[i].d = i;
+    tuple[i].f = 0;
+  }
+}
+
+int next_builder( state *s, feature *tuple, ub1 n)
+{
+  sb4 i = n;
+
+  while (i-- &&
+	 tuple[i].d == s->ndim-n+i &&
+	 tuple[i].f == s->dim[tuple[i].d]-1)
+    ;
+  if (i == -1)
+    return FALSE;
+  else if (tuple[i].f < s->dim[tuple[i].d]-1) {
+    ++tuple[i].f;                                       /* increment feature */
+    for (i; i<n-1; ++i) {            /* reset all less significant positions */
+      tuple[i+1].d = tuple[i].d+1;
+      tuple[i+1].f = 0;
+    }
+  }
+  else {
+    ++tuple[i].d;      /* increment least significant non-maxed-out position */
+    tuple[i].f = (ub2)0;                                /* reset its feature */
+    for (i; i<n-1; ++i) {            /* reset all less significant positions */
+      tuple[i+1].d = tuple[i].d+1;
+      tuple[i+1].f = 0;
+    }
+  }
+  return TRUE;
+}
+
+
+/*
+------------------------------------------------------------------------------
+Bitsets of uncovered tuples
+
+bits[d][f] holds the same tuples as tu[d][f], so count_tuples can count
+the ones a test covers with AND and popcount instead of walking the list.
+Features are numbered as slots, dimension d having slots soff[d] up to
+soff[d]+dim[d]-1.  Call the members of an n-tuple other than (d,f), in
+dimension order, o1..o(n-1).  The tuple is bit o(n-1) of the row
+numbered o1*nslot^(n-3) + ... + o(n-2), rows being nword ub8s apiece.
+A test covers the tuple when it has every oi, so if tmask has the test's
+slots, the tuples it covers are popcount(row & tmask) summed over the
+rows for its own n-2 features.  That is one row for pairs and ndim-1
+rows for triples.  The lists stay: the order tuples get chosen in comes
+from them.  Bitsets bigger than BITSET_WORDS are not kept.
+------------------------------------------------------------------------------
+*/
+
+#if defined(__GNUC__)
+#define POPCOUNT(x) ((ub4)__builtin_popcountll(x))
+#else
+static ub4 POPCOUNT( ub8 x)
+{
+  x = x - ((x >> 1) & 0x5555555555555555LL);
+  x = (x & 0x3333333333333333LL) + ((x >> 2) & 0x3333333333333333LL);
+  x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0fLL;
+  return (ub4)((x * 0x0101010101010101LL) >> 56);
+}
+#endif
+
+/* start a new bitset for the n-tuples of (d,f), if it is small enough */
+static void new_bits( state *s, ub2 d, ub2 f, ub1 n)
+{
+  ub8 words = s->nword;
+  ub1 i;
+
+  if (s->bits[d][f]) {
+    my_free((char *)s->bits[d][f]);
+    s->bits[d][f] = (ub8 *)0;
+  }
+  if (n < 2) return;
+  for (i=2; i<n && words <= BITSET_WORDS; ++i) {
+    words *= s->nslot;
+  }
+  if (words <= BITSET_WORDS) {
+    s->bits[d][f] = (ub8 *)my_alloc(s, sizeof(ub8)*(size_t)words);
+  }
+}
+
+/* set or clear the bit for tuple in bits[d][f] */
+static void flip_bit( state *s, ub2 d, ub2 f, feature *tuple, ub1 n, int on)
+{
+  ub4 i, row = 0, last = UB4MAXVAL;
+  ub8 *bits = s->bits[d][f];
+
+  if (!bits) return;
+  for (i=0; i<n; ++i) {
+    if (tuple[i].d == d) continue;
+    if (last != UB4MAXVAL) row = row*s->nslot + last;
+    last = s->soff[tuple[i].d] + tuple[i].f;
+  }
+  if (on) {
+    bits[row*s->nword + last/64] |= ((ub8)1 << (last%64));
+  } else {
+    bits[row*s->nword + last/64] &= ~((ub8)1 << (last%64));
+  }
+}
+
+/* count tuples covered by t in the rows for depth more dimensions >= from */
+static ub4 count_bits( state *s, climb *c, test *t, ub8 *bits, ub2 d, 
+		       ub2 from, ub1 depth, ub4 row)
+{
+  ub4 count = 0;
+  ub4 i;
+
+  if (depth == 0) {
+    ub8 *b = &bits[row*s->nword];
+    for (i=0; i<s->nword; ++i) {
+      count += POPCOUNT(b[i] & c->tmask[i]);
+    }
+  } else {
+    for (i=from; i<s->ndim; ++i) {
+      if (i != d) {
+	count += count_bits(s, c, t, bits, d, i+1, depth-1, 
+			    row*s->nslot + s->soff[i] + t->f[i]);
+      }
+    }
+  }
+  return count;
+}
+
+/*
+------------------------------------------------------------------------------
+Checking withouts incrementally
+
+A test disobeys a without when, in every dimension the without names, the
+test has one of the features the without lists there.  count_withouts
+rechecks whole withouts, which is slow when there are hundreds of them
+and the hillclimbers try every feature of every dimension.  Instead
+wlist, indexed by wfirst, lists for each feature slot the withouts that
+use it.  A candidate keeps wmatch[i], how many dimensions of without i
+it matches, and the without is disobeyed when that reaches its ndim.
+Changing one feature then only visits the withouts of the old and new
+feature.  whit[d] is what count_withouts(t, s->wc[d]) would return.
+Checking a lone tuple against the withouts works the same way.
+------------------------------------------------------------------------------
+*/
+
+/* without i became disobeyed (delta 1) or obeyed again (delta -1) */
+static void hit_without( state *s, climb *c, ub4 i, sb4 delta)
+{
+  without *w = s->wall[i];
+  ub2      j;
+
+  c->nhit += delta;
+  for (j=0; j<w->len; ++j) {
+    if (j == 0 || w->fe[j].d != w->fe[j-1].d) {
+      c->whit[w->fe[j].d] += delta;
+    }
+  }
+}
+
+/* count the dimensions of each without t matches, return how many it hits */
+static ub4 match_withouts( state *s, climb *c, test *t)
+{
+  ub4 d, j;
+
+  memset(c->wmatch, 0, sizeof(ub2)*s->nw);
+  memset(c->whit, 0, sizeof(ub4)*s->ndim);
+  c->nhit = 0;
+  for (d=0; d<s->ndim; ++d) {
+    ub4 slot = s->soff[d] + t->f[d];
+    for (j=s->wfirst[slot]; j<s->wfirst[slot+1]; ++j) {
+      ub4 i = s->wlist[j];
+      if (++c->wmatch[i] == s->wall[i]->ndim) {
+	hit_without(s, c, i, 1);
+      }
+    }
+  }
+  return c->nhit;
+}
+
+/* set t->f[d] to f, keeping the counts from match_withouts current */
+static void move_feature( state *s, climb *c, test *t, ub2 d, ub2 f)
+{
+  ub4 slot = s->soff[d] + t->f[d];
+  ub4 j;
+
+  if (t->f[d] == f) return;
+  for (j=s->wfirst[slot]; j<s->wfirst[slot+1]; ++j) {
+    ub4 i = s->wlist[j];
+    if (c->wmatch[i]-- == s->wall[i]->ndim) {
+      hit_without(s, c, i, -1);
+    }
+  }
+  t->f[d] = f;
+  slot = s->soff[d] + f;
+  for (j=s->wfirst[slot]; j<s->wfirst[slot+1]; ++j) {
+    ub4 i = s->wlist[j];
+    if (++c->wmatch[i] == s->wall[i]->ndim) {
+      hit_without(s, c, i, 1);
+    }
+  }
+}
+
+/* does a tuple, with nothing in its other dimensions, disobey a without?
+   tally is nw+1 zeros of scratch, and is left that way */
+static int tally_withouts( state *s, ub2 *tally, feature *tuple, ub1 n)
+{
+  int hit = FALSE;
+  ub4 j, slot;
+  ub1 k;
+
+  for (k=0; k<n; ++k) {
+    slot = s->soff[tuple[k].d] + tuple[k].f;
+    for (j=s->wfirst[slot]; j<s->wfirst[slot+1]; ++j) {
+      ub4 i = s->wlist[j];
+      if (++tally[i] == s->wall[i]->ndim) {
+	hit = TRUE;
+      }
+    }
+  }
+  for (k=0; k<n; ++k) {                   /* leave tally all zero again */
+    slot = s->soff[tuple[k].d] + tuple[k].f;
+    for (j=s->wfirst[slot]; j<s->wfirst[slot+1]; ++j) {
+      tally[s->wlist[j]] = 0;
+    }
+  }
+  return hit;
+}
+
+static int tuple_withouts( state *s, feature *tuple, ub1 n)
+{
+  return tally_withouts(s, s->wtally, tuple, n);
+}
+
+void build_tuples( state *s, ub2 d, ub2 f)
+{
+  feature  offset[MAX_N];                                      /* n-1-tuples */
+  feature  tuple[MAX_N];                      /* n-tuples that include (d,f) */
+  sb4      i, n = s->n[d][f];
+  ub4      j;
+  ub8      count = 0;
+  tu_iter  ctx;
+
+  if (s->tc[d][f] > 0 || s->n[d][f] == s->n_final) {
     return;                               /* no need to generate more tuples */
   }
 
   n = ++s->n[d][f];                        /* move up to a bigger tuple size */
+  new_bits(s, d, f, n);
 
   /* get ready to insert tuples into the tuple list for (d,f) */
   start_tuple(&ctx, &s->tu[d][f], n, &s->tc[d][f]);
@@ -1190,15 +2109,14 @@ void build_tuples( state *s, ub2 d, ub2 f)
     for (i=0; i<n; ++i) {
       s->tuple_tester->f[tuple[i].d] = tuple[i].f;
     }
-    if (count_withouts(s->tuple_tester, s->wc2) ||
+    if (tuple_withouts(s, tuple, n) ||
 	count_withouts(s->tuple_tester, s->wc3))
       goto make_next_tuple;
 
-    /* is this tuple covered by the existing tests? */
-    for (j=0; j<s->ntests; ++j) {
-      test *t = s->t[j];
+    /* is this tuple covered by the existing tests?  (-d: none, yet) */
+    for (j=0; j<s->ntests && !s->delta; ++j) {
       for (i=0; i<n; ++i) {
-	if (t->f[tuple[i].d] != tuple[i].f) {
+	if (get_feature(s, j, tuple[i].d) != tuple[i].f) {
 	  break;
 	}
       }
@@ -1212,6 +2130,7 @@ void build_tuples( state *s, ub2 d, ub2 f)
       printf("jenny: could not insert tuple\n");
       return;
     }
+    flip_bit(s, d, f, tuple, n, TRUE);
     ++count;
 
     /* next tuple */
@@ -1245,6 +2164,7 @@ void build_tuples( state *s, ub2 d, ub2 f)
 #define MAX_NO_PROGRESS 2
 int obey_withouts(
 state *s,                                                    /* global state */
+climb *c,                                       /* scratch for building t */
 test  *t,                                                /* test being built */
 ub1   *mut)              /* mut[i] = 1 if I am allowed to adjust dimension i */
 {
@@ -1255,20 +2175,20 @@ ub1   *mut)              /* mut[i] = 1 if I am allowed to adjust dimension i */
   ub2      temp;
 
   /* how many withouts are currently disobeyed? */
-  if (!count_withouts(t, s->wc2))
+  if (!match_withouts(s, c, t))
     return TRUE;
 
   /* fill dimord[] with all dimensions that can and should be tweaked */
   for (ndim=0, i=0; i<s->ndim; ++i) {
     if (mut[i] && s->wc[i]) {
-      s->dimord[ndim++] = i;
+      c->dimord[ndim++] = i;
     }
   }
 
   /* hillclimbing, with sidestepping, minimize number of withouts hit */
   for (i=0; i<MAX_NO_PROGRESS; ++i) {
     ub4     j;
-    ub2     best[MAX_FEATURES];                      /* best features so far */
+    ub2    *best = c->best;                          /* best features so far */
     ub1     ok = TRUE;
     
     for (j=ndim; j>0; --j) {
@@ -1277,20 +2197,20 @@ ub1   *mut)              /* mut[i] = 1 if I am allowed to adjust dimension i */
       ub2 k;
 
       /* walk the dimensions in a random order, no replacement */
-      mydim = flearand(&s->r) % j;
-      temp = s->dimord[mydim];
-      s->dimord[mydim] = s->dimord[j-1];
-      s->dimord[j-1] = temp;
-      mydim = s->dimord[j-1];
+      mydim = (ub2)flearand_range(c->r, j);
+      temp = c->dimord[mydim];
+      c->dimord[mydim] = c->dimord[j-1];
+      c->dimord[j-1] = temp;
+      mydim = c->dimord[j-1];
 
       /* see how many withouts this dimension is disobeying */
-      count = count_withouts(t, s->wc[mydim]);
+      count = c->whit[mydim];
 
       /* test every feature of this dimension, trying to make progress */
       for (k=0; k<s->dim[mydim]; ++k) {
 	ub2 newcount;
-	t->f[mydim] = k;
-	newcount = count_withouts(t, s->wc[mydim]);
+	move_feature(s, c, t, mydim, k);
+	newcount = (ub2)c->whit[mydim];
 	if (newcount <= count) {
 	  if (newcount < count) {
 	    i = 0;                                      /* partial progress! */
@@ -1305,10 +2225,10 @@ ub1   *mut)              /* mut[i] = 1 if I am allowed to adjust dimension i */
       if (fcount == 0) {
 	printf("jenny: internal error a\n");
       } else if (fcount == 1) {
-	t->f[mydim] = best[0];
+	move_feature(s, c, t, mydim, best[0]);
       } else {
-	temp = (flearand(&s->r) % fcount);
-	t->f[mydim] = best[temp];
+	temp = (ub2)flearand_range(c->r, fcount);
+	move_feature(s, c, t, mydim, best[temp]);
       }
 
       if (count > 0)
@@ -1321,12 +2241,26 @@ ub1   *mut)              /* mut[i] = 1 if I am allowed to adjust dimension i */
   return FALSE;               /* failure, could not satisfy all the withouts */
 }
 
-ub4 count_tuples( state *s, test *t, int d, int f)
+ub4 count_tuples( state *s, climb *c, test *t, int d, int f)
 {
   ub4      count = 0;
   ub1      n = s->n[d][f];
   tu_iter  ctx;
-  feature *this = start_tuple(&ctx, &s->tu[d][f], n, &s->tc[d][f]);
+  feature *this;
+
+  /* use the bitset, unless the list is shorter */
+  if (s->bits[d][f] && 
+      (ub8)s->tc[d][f]*n > (ub8)s->bscan[n]*s->nword) {
+    ub4 i;
+    memset(c->tmask, 0, sizeof(ub8)*s->nword);
+    for (i=0; i<s->ndim; ++i) {
+      ub4 slot = s->soff[i] + t->f[i];
+      c->tmask[slot/64] |= ((ub8)1 << (slot%64));
+    }
+    return count_bits(s, c, t, s->bits[d][f], d, 0, n-2, 0);
+  }
+
+  this = start_tuple(&ctx, &s->tu[d][f], n, &s->tc[d][f]);
   while (this) {
     count += test_tuple(t->f, this, n);
     this = next_tuple(&ctx);
@@ -1336,6 +2270,7 @@ ub4 count_tuples( state *s, test *t, int d, int f)
 
 ub4 maximize_coverage( 
 state *s,                                                    /* global state */
+climb *c,                                       /* scratch for building t */
 test  *t,            /* testcase being built, already obeys all restrictions */
 ub1   *mut,                        /* mut[i] = 1 if I can adjust dimension i */
 ub1    n)                            /* size of smallest tuple left to cover */
@@ -1348,9 +2283,10 @@ ub1    n)                            /* size of smallest tuple left to cover */
   /* build a list of all the dimensions that we can modify */
   for (ndim=0, i=0; i<s->ndim; ++i) {
     if (mut[i]) {
-      s->dimord[ndim++] = i;
+      c->dimord[ndim++] = i;
     }
   }
+  (void)match_withouts(s, c, t);
 
   /* repeatedly loop through all dimensions, maximizing tuple coverage */
   do {
@@ -1359,26 +2295,26 @@ ub1    n)                            /* size of smallest tuple left to cover */
 
     /* scramble the array of dimensions; */
     for (i=ndim; i>1; --i) {
-      ub2 j = flearand(&s->r) % i;
-      ub2 temp = s->dimord[i-1];
-      s->dimord[i-1] = s->dimord[j];
-      s->dimord[j] = temp;
+      ub2 j = (ub2)flearand_range(c->r, i);
+      ub2 temp = c->dimord[i-1];
+      c->dimord[i-1] = c->dimord[j];
+      c->dimord[j] = temp;
     }
 
     /* for every dimension that we can adjust */
     for (i=0; i<ndim; ++i) {
-      ub2 best[MAX_FEATURES];     /* list of features with the best coverage */
+      ub2 *best = c->best;        /* list of features with the best coverage */
       ub2 count = 0;                                       /* size of best[] */
-      ub2 d = s->dimord[i];
+      ub2 d = c->dimord[i];
       ub1 best_n = s->n[d][t->f[d]];
-      ub4 coverage = count_tuples(s, t, d, t->f[d]);
+      ub4 coverage = count_tuples(s, c, t, d, t->f[d]);
       ub4 f;
 
       /* for every feature in mydim, see if using it would improve coverage */
       for (f=0; f<s->dim[d]; ++f) {
-	t->f[d] = f;                            /* switch to the new feature */
-	if (!count_withouts(t, s->wc[d])) {         /* need to obey withouts */
-	  ub4 new_coverage = count_tuples(s, t, d, f);
+	move_feature(s, c, t, d, f);            /* switch to the new feature */
+	if (!c->whit[d]) {                          /* need to obey withouts */
+	  ub4 new_coverage = count_tuples(s, c, t, d, f);
 	  if (s->n[d][f] < best_n) {
 	    best_n = s->n[d][f];
 	    progress = TRUE;
@@ -1405,9 +2341,9 @@ ub1    n)                            /* size of smallest tuple left to cover */
       if (count == 0) {
 	printf("jenny: internal error b\n");
       } else if (count == 1) {
-	t->f[d] = best[0];
+	move_feature(s, c, t, d, best[0]);
       } else {
-	t->f[d] = best[flearand(&s->r) % count];
+	move_feature(s, c, t, d, best[flearand_range(c->r, count)]);
       }
       if (s->n[d][t->f[d]] == n)
 	total += coverage;
@@ -1424,7 +2360,7 @@ ub1    n)                            /* size of smallest tuple left to cover */
  * if we couldn't satisfy the withouts while covering this tuple.
  */
 #define MAX_ITERS 10
-ub4 generate_test( state *s, test *t, feature *tuple, ub1 n)
+ub4 generate_test( state *s, climb *c, test *t, feature *tuple, ub1 n)
 {
   int  iter, i;
   ub1  mut[MAX_DIMENSIONS];        /* mut[i] = 1 if I can adjust dimension i */
@@ -1436,8 +2372,9 @@ ub4 generate_test( state *s, test *t, feature *tuple, ub1 n)
   
   for (iter=0; iter<MAX_ITERS; ++iter) {
     /* Produce a totally random testcase */
+    flearand_fill(c->r, c->draw, s->ndim);
     for (i=0; i<s->ndim; ++i) {
-      t->f[i] = flearand(&s->r) % (s->dim[i]);
+      t->f[i] = (ub2)flearand_scale(c->r, c->draw[i], s->dim[i]);
     }
     
     /* Plug in the chosen new tuple */
@@ -1446,7 +2383,7 @@ ub4 generate_test( state *s, test *t, feature *tuple, ub1 n)
     }
 
     /* If we can get all the withouts obeyed, break, success */
-    if (!s->wc2 || obey_withouts(s, t, mut)) {
+    if (!s->wc2 || obey_withouts(s, c, t, mut)) {
       if (count_withouts(t, s->wc2)) {
 	printf("internal error without %d\n", s->wc2);
       }
@@ -1463,23 +2400,162 @@ ub4 generate_test( state *s, test *t, feature *tuple, ub1 n)
    * We now have a test that covers the new tuple and satisfies withouts.
    * Do hillclimbing to cover as many new tuples as possible.
    */
-  coverage = maximize_coverage(s, t, mut, n);
+  coverage = maximize_coverage(s, c, t, mut, n);
 
  done:
   return coverage;
 }
 
-#define GROUP_SIZE 5
+/*
+ * With -t, every candidate test gets its own climb and random numbers,
+ * seeded from s->r in candidate order, so the candidates do not depend on
+ * each other or on which thread builds them.  Thread i builds candidates
+ * i, i+nthreads, i+2*nthreads ...
+ */
+typedef  struct runner {
+  state     *s;
+  feature   *tuple;                            /* the tuple every test covers */
+  ub1        n;                                        /* size of the tuple */
+  ub2        first;                       /* first candidate this one builds */
+#ifdef THREADS
+  pthread_t  thread;
+#endif
+} runner;
+
+static void *run_group( void *arg)
+{
+  runner *run = (runner *)arg;
+  state  *s = run->s;
+  ub4     i;
+  for (i=run->first; i<s->ngroup; i+=s->nthreads) {
+    climb *c = &s->c[i];
+    c->coverage = generate_test(s, c, c->t, run->tuple, run->n);
+  }
+  return (void *)0;
+}
+
+/* build all the candidate tests for a tuple, s->c[i].t and .coverage */
+void build_group( state *s, feature *tuple, ub1 n)
+{
+  runner run[MAX_THREADS];
+  ub2    i;
+
+  for (i=0; i<s->ngroup; ++i) {
+    flearand_init(&s->c[i].own, flearand(&s->r));
+  }
+  for (i=0; i<s->nthreads; ++i) {
+    run[i].s = s;
+    run[i].tuple = tuple;
+    run[i].n = n;
+    run[i].first = i;
+  }
+#ifdef THREADS
+  for (i=1; i<s->nthreads; ++i) {
+    if (pthread_create(&run[i].thread, (pthread_attr_t *)0, 
+		       run_group, (void *)&run[i])) {
+      printf("jenny: could not start a thread\n");
+      cleanup(s);
+      exit(0);
+    }
+  }
+  (void)run_group((void *)&run[0]);
+  for (i=1; i<s->nthreads; ++i) {
+    (void)pthread_join(run[i].thread, (void **)0);
+  }
+#else
+  for (i=0; i<s->nthreads; ++i) {
+    (void)run_group((void *)&run[i]);
+  }
+#endif
+}
+
+/* remove all the tuples t covers from the lists of uncovered tuples */
+void remove_covered( state *s, test *t)
+{
+  ub2      d;
+  for (d=0; d<s->ndim; ++d) {
+    tu_iter  ctx;
+    ub2      f = t->f[d];
+    ub1      n = s->n[d][f];
+    feature *this = start_tuple(&ctx, &s->tu[d][f], n, &s->tc[d][f]);
+
+    while (this) {
+      if (test_tuple(t->f, this, n)) {
+	flip_bit(s, d, f, this, n, FALSE);
+	this = delete_tuple(&ctx);
+      } else {
+	this = next_tuple(&ctx);
+      }
+    }
+  }
+}
+
+/*
+ * -d: the old tests cover every tuple of dimensions 0..nolddim-1, so
+ * only tuples with a new dimension are needed.  Those are built straight
+ * at n_final, in the lists of their new dimensions only; old dimensions
+ * are marked done.  Then each old test gets the new dimensions that cover
+ * the most of them, and cover_tuples does the rest.
+ */
+int extend_tests( state *s)
+{
+  ub1    mut[MAX_DIMENSIONS];       /* mut[i] = 1 if I can adjust dimension i */
+  climb *c = &s->c[0];
+  test  *t = c->t;
+  ub4    d, f, i;
+
+  if (s->nthreads)            /* -t: c->r is c[0].own, which build_group seeds */
+    flearand_init(&s->c[0].own, flearand(&s->r));
+  for (d=0; d<s->ndim; ++d) {
+    mut[d] = (d >= s->nolddim);
+    for (f=0; f<s->dim[d]; ++f) {
+      if (d < s->nolddim) {
+	s->n[d][f] = s->n_final;
+      } else {
+	s->n[d][f] = s->n_final-1;
+	build_tuples(s, (ub2)d, (ub2)f);
+      }
+    }
+  }
+  if (s->nolddim == s->ndim)
+    return TRUE;
+
+  for (i=0; i<s->nold; ++i) {
+    int iter;
+    get_test(s, i, t);
+    for (iter=0; iter<MAX_ITERS; ++iter) {
+      for (d=s->nolddim; d<s->ndim; ++d) {
+	t->f[d] = (ub2)flearand_range(c->r, s->dim[d]);
+      }
+      if (!s->wc2 || obey_withouts(s, c, t, mut))
+	break;
+    }
+    if (iter == MAX_ITERS) {
+      printf("jenny: -d, every way to extend old testcase %ld breaks a without\n",
+	     i+1);
+      return FALSE;
+    }
+    (void)maximize_coverage(s, c, t, mut, s->n_final);
+    remove_covered(s, t);
+    for (d=s->nolddim; d<s->ndim; ++d) {
+      put_feature(s, i, d, t->f[d]);
+    }
+  }
+  return TRUE;
+}
+
 void cover_tuples( state *s)
 {
   test *curr_test;
+  test *best_test;                      /* add_test keeps a packed copy */
   curr_test = (test *)my_alloc( s, sizeof(test));
   curr_test->f = (ub2 *)my_alloc( s, sizeof(ub2)*s->ndim);
+  best_test = (test *)my_alloc( s, sizeof(test));
+  best_test->f = (ub2 *)my_alloc( s, sizeof(ub2)*s->ndim);
 
   while (TRUE) {
     ub4         i;
     ub2         d;
-    test       *best_test;
     sb4         best_count = -1;
     ub1         tuple_n = MAX_N;
     ub4         tuple_count = 0;
@@ -1514,17 +2590,23 @@ void cover_tuples( state *s)
 	continue;
     }
 
-
-    best_test = (test *)my_alloc( s, sizeof(test));
-    best_test->f = (ub2 *)my_alloc( s, sizeof(ub2)*s->ndim);
-
     /* find a good test */
-    for (i=0; i<GROUP_SIZE; ++i) {
-      tu_iter  ctx;
+    if (s->nthreads) {
+      build_group(s, tuple, tuple_n);
+      for (i=0; i<s->ngroup; ++i) {
+	climb *c = &s->c[i];
+	if (c->coverage && (sb4)c->coverage > best_count) {
+	  covered = TRUE;
+	  best_count = c->coverage;
+	  memcpy(best_test->f, c->t->f, sizeof(ub2)*s->ndim);
+	}
+      }
+    } else for (i=0; i<GROUP_SIZE; ++i) {
       sb4      this_count;
 
       /* generate a test that covers the first tuple */
-      if (!(this_count = generate_test(s, curr_test, tuple, tuple_n))) {
+      if (!(this_count = generate_test(s, &s->c[0], curr_test, tuple, 
+				       tuple_n))) {
 	continue;
       }
       covered = TRUE;
@@ -1550,8 +2632,8 @@ void cover_tuples( state *s)
 	extra[i].f = tuple[i].f;
       }
 
-      printf("Could not cover tuple ");
-      show_tuple(tuple, tuple_n);
+      fprintf(note_file(s), "Could not cover tuple ");
+      show_tuple(note_file(s), s, tuple, tuple_n);
 
       /* add this tuple to the list of restrictions */
       wc->w = w;
@@ -1575,6 +2657,7 @@ void cover_tuples( state *s)
 	  /* remove all the tuples covered by it */
 	  while (this) {
 	    if (subset_tuple(extra, tuple_n, this, n)) {
+	      flip_bit(s, d, f, this, n, FALSE);
 	      this = delete_tuple(&ctx);
 	    } else {
 	      this = next_tuple(&ctx);
@@ -1582,29 +2665,15 @@ void cover_tuples( state *s)
 	  }
 	}
       }
-      my_free((char *)best_test->f);
-      my_free((char *)best_test);
     } else {
-      ub2      d;
-      for (d=0; d<s->ndim; ++d) {
-	tu_iter  ctx;
-	ub2      f = best_test->f[d];
-	ub1      n = s->n[d][f];
-	feature *this = start_tuple(&ctx, &s->tu[d][f], n, &s->tc[d][f]);
-	
-	/* remove all the tuples covered by it */
-	while (this) {
-	  if (test_tuple(best_test->f, this, n)) {
-	    this = delete_tuple(&ctx);
-	  } else {
-	    this = next_tuple(&ctx);
-	  }
-	}
-      }
+      remove_covered(s, best_test);
 
       /* add it to the list of tests */
-      if (!add_test(s, best_test)) {
-	printf("jenny: exceeded maximum number of tests\n");
+      if (add_test(s, best_test)) {
+	if (s->format != OUT_JENNY)
+	  emit_test(s, best_test, s->ntests);       /* -j or -c, stream it now */
+      } else {
+	fprintf(note_file(s), "jenny: exceeded maximum number of tests\n");
 	my_free((char *)curr_test->f);
 	my_free((char *)curr_test);
 	my_free((char *)best_test->f);
@@ -1617,84 +2686,394 @@ void cover_tuples( state *s)
 
   my_free((char *)curr_test->f);
   my_free((char *)curr_test);
+  my_free((char *)best_test->f);
+  my_free((char *)best_test);
+}
+
+/*
+------------------------------------------------------------------------------
+Reducing the tests
+
+Covering greedily leaves slack: the last few tests are often there for a
+handful of tuples that earlier tests could have picked up with a small
+change.  tbits[d][f] has a bit for each test with feature f in dimension
+d, so the tests covering a tuple are the AND of its n rows.  Finding the
+tuples covered only once then means looking at each test's own tuples,
+not at every tuple against every test.  onec[t][d] counts the tuples
+only test t covers that involve dimension d; when it is 0, test t can
+change dimension d without uncovering anything.
+
+reduce_tests repeatedly takes the test with the fewest once-covered
+tuples, drops it, and fits each tuple only it covered into some other
+test by changing dimensions of that test which are free.  If some tuple
+will not fit, the changes are undone and the test is marked as tried.
+Tests read by -o are never dropped or changed.
+------------------------------------------------------------------------------
+*/
+
+#if defined(__GNUC__)
+#define LOWBIT(x) ((ub4)__builtin_ctzll(x))
+#else
+static ub4 LOWBIT( ub8 x)
+{
+  ub4 i;
+  for (i=0; !(x & 1); ++i) {
+    x >>= 1;
+  }
+  return i;
+}
+#endif
+
+/* a change made while reducing, kept so it can be undone */
+typedef  struct change {
+  ub4  t;                                           /* the test changed */
+  ub2  d;                                      /* the dimension changed */
+  ub2  f;                                      /* its feature beforehand */
+} change;
+
+/* set or clear the bit for test t in tbits[d][f] */
+static void set_tbit( state *s, ub4 t, ub2 d, ub2 f, int on)
+{
+  if (on) {
+    s->tbits[d][f][t/64] |= ((ub8)1 << (t%64));
+  } else {
+    s->tbits[d][f][t/64] &= ~((ub8)1 << (t%64));
+  }
+}
+
+/* count tests other than except that cover tuple, *which is one of them */
+static ub4 who_covers( state *s, feature *tuple, ub1 n, ub4 except, 
+		       ub4 *which)
+{
+  ub4 count = 0;
+  ub4 w;
+  ub1 i;
+
+  for (w=0; w<s->tword; ++w) {
+    ub8 x = s->tbits[tuple[0].d][tuple[0].f][w];
+    for (i=1; i<n && x; ++i) {
+      x &= s->tbits[tuple[i].d][tuple[i].f][w];
+    }
+    if (w == except/64) {
+      x &= ~((ub8)1 << (except%64));
+    }
+    if (x) {
+      count += POPCOUNT(x);
+      *which = w*64 + LOWBIT(x);
+    }
+  }
+  return count;
+}
+
+/* the first k dimensions other than skip; FALSE if there are not k */
+static int first_dims( state *s, ub2 *dims, ub1 k, ub4 skip)
+{
+  ub4 d = 0;
+  ub1 i;
+
+  for (i=0; i<k; ++i, ++d) {
+    if (d == skip) ++d;
+    if (d >= s->ndim) return FALSE;
+    dims[i] = (ub2)d;
+  }
+  return TRUE;
+}
+
+/* the next k dimensions other than skip; FALSE after the last */
+static int next_dims( state *s, ub2 *dims, ub1 k, ub4 skip)
+{
+  sb4 i;
+
+  for (i=k-1; i>=0; --i) {
+    ub4 d = dims[i]+1;
+    ub1 j;
+    for (j=(ub1)i; j<k; ++j, ++d) {
+      if (d == skip) ++d;
+      if (d >= s->ndim) break;
+      dims[j] = (ub2)d;
+    }
+    if (j == k) return TRUE;
+  }
+  return FALSE;
+}
+
+/* add delta to onec[t] for every dimension of tuple */
+static void add_onec( state *s, ub4 t, feature *tuple, ub1 n, sb4 delta)
+{
+  ub1 i;
+  for (i=0; i<n; ++i) {
+    s->onec[t][tuple[i].d] += delta;
+  }
 }
 
+/* index the tests by feature and count their once-covered tuples */
 void prepare_reduce( state *s) 
 {
-  feature tuple[MAX_N];
-  ub1     n = s->n_final;
-  ub4     t, d;
+  ub2      dims[MAX_N];
+  feature  tuple[MAX_N];
+  ub1      n = s->n_final;
+  ub4      t, d, f, which;
+  ub1      i;
+
+  free_reduce(s);
+  s->onec = (ub4 **)my_alloc( s, sizeof(ub4 *)*(s->ntests+1));
+  for (t=0; t<s->ntests; ++t) {
+    s->onec[t] = (ub4 *)my_alloc( s, sizeof(ub4)*s->ndim);
+  }
+  s->tword = (s->ntests+63)/64;
+  s->tbits = (ub8 ***)my_alloc( s, sizeof(ub8 **)*s->ndim);
+  for (d=0; d<s->ndim; ++d) {
+    s->tbits[d] = (ub8 **)my_alloc( s, sizeof(ub8 *)*s->dim[d]);
+    for (f=0; f<s->dim[d]; ++f) {
+      s->tbits[d][f] = (ub8 *)my_alloc( s, sizeof(ub8)*(s->tword+1));
+    }
+  }
+  for (t=0; t<s->ntests; ++t) {
+    for (d=0; d<s->ndim; ++d) {
+      set_tbit(s, t, (ub2)d, get_feature(s, t, d), TRUE);
+    }
+  }
 
+  /* a tuple of t is covered once if no other test covers it */
   for (t=0; t<s->ntests; ++t) {
     for (d=0; d<s->ndim; ++d) {
       s->onec[t][d] = 0;
     }
+    if (first_dims(s, dims, n, UB4MAXVAL)) do {
+      for (i=0; i<n; ++i) {
+	tuple[i].d = dims[i];
+	tuple[i].f = get_feature(s, t, dims[i]);
+      }
+      if (who_covers(s, tuple, n, t, &which) == 0) {
+	add_onec(s, t, tuple, n, 1);
+      }
+    } while (next_dims(s, dims, n, UB4MAXVAL));
   }
+}
 
-  /* Iterate through all the tuples */
-  start_builder( s, tuple, n);
+/* take test t out of the index, gone[] gets the tuples nothing covers now */
+static ub4 unindex_test( state *s, ub4 t, feature *gone)
+{
+  ub2      dims[MAX_N];
+  feature  tuple[MAX_N];
+  ub1      n = s->n_final;
+  ub4      d, which, ngone = 0;
+  ub1      i;
 
-  for (;;) {
-    sb4 i;
-    ub2 thistest;
+  for (d=0; d<s->ndim; ++d) {
+    set_tbit(s, t, (ub2)d, get_feature(s, t, d), FALSE);
+    s->onec[t][d] = 0;
+  }
+  if (first_dims(s, dims, n, UB4MAXVAL)) do {
+    for (i=0; i<n; ++i) {
+      tuple[i].d = dims[i];
+      tuple[i].f = get_feature(s, t, dims[i]);
+    }
+    switch (who_covers(s, tuple, n, UB4MAXVAL, &which)) {
+    case 0:
+      memcpy(&gone[ngone*n], tuple, sizeof(feature)*n);
+      ++ngone;
+      break;
+    case 1:
+      add_onec(s, which, tuple, n, 1);               /* which has it alone */
+      break;
+    }
+  } while (next_dims(s, dims, n, UB4MAXVAL));
+  return ngone;
+}
+
+/* put test t back in the index, undoing unindex_test */
+static void index_test( state *s, ub4 t)
+{
+  ub2      dims[MAX_N];
+  feature  tuple[MAX_N];
+  ub1      n = s->n_final;
+  ub4      d, which;
+  ub1      i;
 
+  for (d=0; d<s->ndim; ++d) {
+    set_tbit(s, t, (ub2)d, get_feature(s, t, d), TRUE);
+  }
+  if (first_dims(s, dims, n, UB4MAXVAL)) do {
     for (i=0; i<n; ++i) {
-      s->tuple_tester->f[tuple[i].d] = tuple[i].f;
+      tuple[i].d = dims[i];
+      tuple[i].f = get_feature(s, t, dims[i]);
     }
-    if (count_withouts(s->tuple_tester, s->wc2) ||
-	count_withouts(s->tuple_tester, s->wc3))
-      goto make_next_tuple;
+    switch (who_covers(s, tuple, n, t, &which)) {
+    case 0:
+      add_onec(s, t, tuple, n, 1);
+      break;
+    case 1:
+      add_onec(s, which, tuple, n, -1);         /* which no longer alone */
+      break;
+    }
+  } while (next_dims(s, dims, n, UB4MAXVAL));
+}
 
-    for (i=0; i<s->ntests; ++i) {
-      ub1 j;
-      for (j=0; j<n; ++j)
-	if (s->t[i]->f[tuple[j].d] != tuple[j].f)
-	  break;
-      if (j == n)
-	break;                              /* this test contains this tuple */
+/* change dimension d of indexed test t to feature f, keeping onec right */
+static void set_feature( state *s, ub4 t, ub2 d, ub2 f)
+{
+  ub2      dims[MAX_N];
+  feature  tuple[MAX_N];
+  ub1      n = s->n_final;
+  ub1      k = n-1;
+  ub2      old = get_feature(s, t, d);
+  ub4      which;
+  ub1      i;
+
+  /* tuples with the old feature lose t */
+  set_tbit(s, t, d, old, FALSE);
+  if (first_dims(s, dims, k, d)) do {
+    for (i=0; i<k; ++i) {
+      tuple[i].d = dims[i];
+      tuple[i].f = get_feature(s, t, dims[i]);
+    }
+    tuple[k].d = d;
+    tuple[k].f = old;
+    switch (who_covers(s, tuple, n, UB4MAXVAL, &which)) {
+    case 0:
+      add_onec(s, t, tuple, n, -1);
+      break;
+    case 1:
+      add_onec(s, which, tuple, n, 1);
+      break;
+    }
+  } while (next_dims(s, dims, k, d));
+
+  /* tuples with the new feature gain t */
+  put_feature(s, t, d, f);
+  set_tbit(s, t, d, f, TRUE);
+  if (first_dims(s, dims, k, d)) do {
+    for (i=0; i<k; ++i) {
+      tuple[i].d = dims[i];
+      tuple[i].f = get_feature(s, t, dims[i]);
+    }
+    tuple[k].d = d;
+    tuple[k].f = f;
+    switch (who_covers(s, tuple, n, t, &which)) {
+    case 0:
+      add_onec(s, t, tuple, n, 1);
+      break;
+    case 1:
+      add_onec(s, which, tuple, n, -1);
+      break;
     }
+  } while (next_dims(s, dims, k, d));
+}
 
-    /* no tests cover this tuple */
-    if (i==s->ntests) {
-      printf("error: some tuple not covered at all\n");
-    } else {
-      thistest = i;
-      for (++i; i<s->ntests; ++i) {
-	ub1 j;
-	for (j=0; j<n; ++j)
-	  if (s->t[i]->f[tuple[j].d] != tuple[j].f)
-	    break;
-	if (j == n)
-	  break;                            /* this test contains this tuple */
-      }
-      if (i == s->ntests) {
-	ub1 j;
-	for (j=0; j<n; ++j) {
-	  tu_iter ctx;
-	  (void)start_tuple(&ctx, &s->one[thistest][tuple[j].d], n, 
-			    &s->onec[thistest][tuple[j].d]);
-	  (void)insert_tuple(s, &ctx, tuple);
-	}
+/* 
+ * Make some test other than skip cover tuple by changing only dimensions
+ * of it that are free.  Of the tests that could, pick one needing the
+ * fewest changes.  Changes are appended to log.  FALSE if none could.
+ */
+static int refit_tuple( state *s, feature *tuple, ub4 skip, 
+			change *log, ub4 *nlog)
+{
+  ub1      n = s->n_final;
+  test    *scratch = s->c[0].t;
+  ub4      t, which, best = UB4MAXVAL, bestdiff = n+1;
+  ub1      i;
+
+  if (who_covers(s, tuple, n, UB4MAXVAL, &which))
+    return TRUE;                      /* an earlier refit picked it up */
+
+  for (t=s->nold; t<s->ntests && bestdiff > 1; ++t) {
+    ub4   diff = 0;
+    if (t == skip) continue;
+    for (i=0; i<n; ++i) {
+      if (get_feature(s, t, tuple[i].d) != tuple[i].f) {
+	if (s->onec[t][tuple[i].d]) break;
+	++diff;
       }
     }
-
-  make_next_tuple:
+    if (i < n || diff >= bestdiff) continue;
+    get_test(s, t, scratch);
     for (i=0; i<n; ++i) {
-      s->tuple_tester->f[tuple[i].d] = (ub2)~0;
+      scratch->f[tuple[i].d] = tuple[i].f;
     }
-    if (!next_builder( s, tuple, n))
-      break;
+    if (count_withouts(scratch, s->wc2)) continue;
+    best = t;
+    bestdiff = diff;
   }
+  if (best == UB4MAXVAL)
+    return FALSE;
+
+  for (i=0; i<n; ++i) {
+    ub2 d = tuple[i].d;
+    if (get_feature(s, best, d) == tuple[i].f) continue;
+    if (s->onec[best][d])
+      return FALSE;                  /* an earlier change here pinned d */
+    log[*nlog].t = best;
+    log[*nlog].d = d;
+    log[*nlog].f = get_feature(s, best, d);
+    ++*nlog;
+    set_feature(s, best, d, tuple[i].f);
+  }
+  return TRUE;
 }
 
-/* find a test to try to eliminate */
-int which_test( state *s)
+/* drop test t if the other tests can take over its tuples, else FALSE */
+static int drop_test( state *s, ub4 t)
+{
+  ub1      n = s->n_final;
+  ub4      ngone = 0;
+  ub4      nlog = 0;
+  ub4      i;
+  int      ok = TRUE;
+  feature *gone;
+  change  *log;
+
+  for (i=0; i<s->ndim; ++i) {
+    ngone += s->onec[t][i];
+  }
+  ngone /= n;
+  gone = (feature *)my_alloc( s, sizeof(feature)*n*(ngone+1));
+  log = (change *)my_alloc( s, sizeof(change)*n*(ngone+1));
+
+  ngone = unindex_test(s, t, gone);
+  for (i=0; ok && i<ngone; ++i) {
+    ok = refit_tuple(s, &gone[i*n], t, log, &nlog);
+  }
+  if (!ok) {
+    while (nlog--) {
+      set_feature(s, log[nlog].t, log[nlog].d, log[nlog].f);
+    }
+    index_test(s, t);
+  }
+
+  my_free((char *)log);
+  my_free((char *)gone);
+  return ok;
+}
+
+/* delete dropped test t, moving the last test's bits and counts to t */
+static void forget_test( state *s, ub4 t)
+{
+  ub4   last = s->ntests-1;
+  ub4   d;
+
+  my_free((char *)s->onec[t]);
+  if (t != last) {
+    for (d=0; d<s->ndim; ++d) {
+      ub2 f = get_feature(s, last, d);
+      set_tbit(s, last, (ub2)d, f, FALSE);
+      set_tbit(s, t, (ub2)d, f, TRUE);
+    }
+    s->onec[t] = s->onec[last];
+  }
+  s->onec[last] = (ub4 *)0;
+  delete_test(s, t);
+}
+
+/* find an untried test to try to eliminate, UB4MAXVAL if none are left */
+ub4 which_test( state *s, ub1 *tried)
 {
   ub4 t;
-  ub4 mincount = ~0;
-  ub4 mint = 0;                  /* test with the fewest once-covered tuples */
-  for (t=0; t<s->ntests; ++t) {
+  ub4 mincount = UB4MAXVAL;
+  ub4 mint = UB4MAXVAL;          /* test with the fewest once-covered tuples */
+  for (t=s->nold; t<s->ntests; ++t) {
     ub4 i, j=0;
+    if (tried[t]) continue;
     for (i=0; i<s->ndim; ++i) {
       j += s->onec[t][i];
     }
@@ -1706,78 +3085,243 @@ int which_test( state *s)
   return mint;
 }
 
+/* drop tests while any can be dropped and there is time left */
 void reduce_tests( state *s) 
 {
-  ub4 t;
+  time_t  stop = time((time_t *)0) + (time_t)s->reduce;
+  ub1    *tried = (ub1 *)my_alloc( s, sizeof(ub1)*(s->ntests+1));
+  ub4     t;
+
   prepare_reduce( s);
-  t = which_test( s);
+  while (time((time_t *)0) < stop && 
+	 (t = which_test( s, tried)) != UB4MAXVAL) {
+    if (drop_test( s, t)) {
+      forget_test( s, t);
+      memset(tried, 0, s->ntests);      /* everything else might fit now */
+    } else {
+      tried[t] = TRUE;
+    }
+  }
+  my_free((char *)tried);
+  free_reduce( s);
 }
 
-/* Confirm that every tuple is covered by either a testcase or a without */
-int confirm( state *s)
+/*
+------------------------------------------------------------------------------
+Confirming the tests
+
+confirm takes the n-tuples one set of n dimensions at a time.  Every
+test sets one bit in a bitmap of all the tuples of those dimensions,
+numbered mixed-radix by their features, and one sweep of the bitmap then
+turns up the tuples no test covers.  Only those few are checked against
+the withouts.  That is ntests+tuples work per set of dimensions, where
+checking each tuple against every test was ntests*tuples.  If a set of
+dimensions has more than CONFIRM_BITS tuples, the tests' numbers are
+sorted instead and the sweep walks through them in step.  With -t, sets
+of dimensions are dealt out to the threads by their leading dimension.
+------------------------------------------------------------------------------
+*/
+
+#define CONFIRM_BITS (((ub8)1)<<24)  /* largest bitmap, per thread, in bits */
+
+typedef  struct checker {
+  state     *s;
+  ub2        first;       /* leading dimensions first, first+nthreads, ... */
+  ub2        step;
+  ub8       *seen;                 /* bitmap of covered tuples, or 0 */
+  ub8       *keys;              /* each test's tuple number, if too big */
+  ub8       *pre;        /* each test's number for all but the last dim */
+  test      *tester;                  /* all ~0, for checking wc3 */
+  ub2       *tally;                      /* scratch for tally_withouts */
+  feature    bad[MAX_N];              /* the first tuple found uncovered */
+  ub1        ok;                      /* FALSE if bad[] is filled in */
+#ifdef THREADS
+  pthread_t  thread;
+#endif
+} checker;
+
+static int cmp_key( const void *a, const void *b)
 {
-  feature  offset[MAX_N];
-  sb4      i, j, n = s->n_final;
+  ub8 x = *(const ub8 *)a, y = *(const ub8 *)b;
+  return (x < y) ? -1 : (x > y);
+}
 
-  /* Make a list of allowed but uncovered tuples */
-  for (i=0; i<n; ++i) {
-    offset[i].d = i;
-    offset[i].f = 0;
+/* is tuple number key of dimensions dims either withouted or reported? */
+static int check_tuple( state *s, checker *k, ub2 *dims, ub8 key)
+{
+  feature tuple[MAX_N];
+  sb4     i, n = s->n_final;
+
+  for (i=n; i--;) {
+    tuple[i].d = dims[i];
+    tuple[i].f = (ub2)(key % s->dim[dims[i]]);
+    key /= s->dim[dims[i]];
   }
+  if (tally_withouts(s, k->tally, tuple, n))
+    return TRUE;
+  if (s->wc3) {
+    int hit;
+    for (i=0; i<n; ++i) k->tester->f[tuple[i].d] = tuple[i].f;
+    hit = count_withouts(k->tester, s->wc3);
+    for (i=0; i<n; ++i) k->tester->f[tuple[i].d] = (ub2)~0;
+    if (hit) return TRUE;
+  }
+  memcpy(k->bad, tuple, sizeof(feature)*n);
+  k->ok = FALSE;
+  return FALSE;
+}
 
-  for (;;) {
-    for (i=0; i<n; ++i) {
-      s->tuple_tester->f[offset[i].d] = offset[i].f;
-    }
-    if (count_withouts(s->tuple_tester, s->wc2) ||
-	count_withouts(s->tuple_tester, s->wc3))
-      goto make_next_tuple;
+/* check every set of dimensions whose leading dimension is k's */
+static void *run_check( void *arg)
+{
+  checker *k = (checker *)arg;
+  state   *s = k->s;
+  ub2      dims[MAX_N];
+  ub2      predims[MAX_N];                /* the dimensions pre[] is for */
+  ub1      n = s->n_final;
+  ub4      j;
+  int      more;
+
+  predims[0] = (ub2)~0;
+
+  for (more = first_dims(s, dims, n, s->ndim); more; 
+       more = next_dims(s, dims, n, s->ndim)) {
+    ub8 total = 1;
+    ub8 key;
+    sb4 i;
+
+    if (dims[0] % k->step != k->first)
+      continue;
+    if (s->delta && dims[n-1] < s->nolddim)
+      continue;                        /* -d: old tests covered these already */
 
-    /* is this tuple covered by the existing tests? */
+    for (i=0; i<n; ++i) total *= s->dim[dims[i]];
+    if (total <= CONFIRM_BITS) {
+      memset(k->seen, 0, sizeof(ub8)*(size_t)((total+63)/64));
+    }
+    if (n > 1 && memcmp(predims, dims, sizeof(ub2)*(n-1))) {
+      memcpy(predims, dims, sizeof(ub2)*(n-1));
+      for (j=0; j<s->ntests; ++j) {      /* only the last dimension varies */
+	for (key=0, i=0; i<n-1; ++i) {
+	  key = key*s->dim[dims[i]] + get_feature(s, j, dims[i]);
+	}
+	k->pre[j] = key;
+      }
+    }
     for (j=0; j<s->ntests; ++j) {
-      test *t = s->t[j];
-      for (i=0; i<n; ++i) {
-	if (t->f[offset[i].d] != offset[i].f) {
-	  break;
+      key = k->pre[j]*s->dim[dims[n-1]] + get_feature(s, j, dims[n-1]);
+      if (total <= CONFIRM_BITS)
+	k->seen[key/64] |= ((ub8)1) << (key%64);
+      else
+	k->keys[j] = key;
+    }
+
+    if (total <= CONFIRM_BITS) {
+      ub8 w;
+      for (w=0; w*64 < total; ++w) {
+	ub8 gaps = ~k->seen[w];
+	if (total - w*64 < 64)
+	  gaps &= (((ub8)1) << (total - w*64)) - 1;
+	while (gaps) {
+	  key = w*64 + LOWBIT(gaps);
+	  gaps &= gaps-1;
+	  if (!check_tuple(s, k, dims, key))
+	    return (void *)0;
 	}
       }
-      if (i == n) {
-	goto make_next_tuple;
+    } else {
+      qsort(k->keys, s->ntests, sizeof(ub8), cmp_key);
+      for (key=0, j=0; key<total; ++key) {
+	while (j < s->ntests && k->keys[j] < key) ++j;
+	if (j < s->ntests && k->keys[j] == key)
+	  continue;
+	if (!check_tuple(s, k, dims, key))
+	  return (void *)0;
       }
     }
+  }
+  return (void *)0;
+}
 
-    printf("problem with %d%c\n", offset[0].d+1, feature_name[offset[0].f]);
-    return FALSE;                       /* found a tuple that is not covered */
-
-  make_next_tuple:
-    for (i=0; i<n; ++i) {
-      s->tuple_tester->f[offset[i].d] = (ub2)~0;
-    }
-    i=n;
-    while (i-- &&
-	   offset[i].d == s->ndim-n+i &&
-	   offset[i].f == s->dim[offset[i].d]-1)
-      ;
-    if (i == -1)
-      break;                                                         /* done */
-    else if (offset[i].f < s->dim[offset[i].d]-1) {
-      ++offset[i].f;                                    /* increment feature */
-      for (i; i<n-1; ++i) {          /* reset all less significant positions */
-	offset[i+1].d = offset[i].d+1;
-	offset[i+1].f = 0;
-      }
+/* Confirm that every tuple is covered by either a testcase or a without */
+int confirm( state *s)
+{
+  checker  k[MAX_THREADS];
+  ub2      nk = (s->nthreads == 0) ? 1 : s->nthreads;
+  ub8      total = 1;
+  ub2      big[MAX_N];
+  ub2      d, i, j;
+  int      ok = TRUE;
+
+  if (s->delta && s->nolddim == s->ndim)
+    return TRUE;                          /* -d, and nothing is new */
+
+  /* the most tuples any set of dimensions can have */
+  for (i=0; i<s->n_final; ++i) big[i] = 0;
+  for (d=0; d<s->ndim; ++d) {
+    ub2 x = s->dim[d];
+    for (i=0; i<s->n_final; ++i) {
+      if (x > big[i]) { ub2 y = big[i]; big[i] = x; x = y; }
     }
-    else {
-      ++offset[i].d;   /* increment least significant non-maxed-out position */
-      offset[i].f = (ub2)0;                             /* reset its feature */
-      for (i; i<n-1; ++i) {          /* reset all less significant positions */
-	offset[i+1].d = offset[i].d+1;
-	offset[i+1].f = 0;
-      }
+  }
+  for (i=0; i<s->n_final && total <= CONFIRM_BITS; ++i) total *= big[i];
+
+  for (i=0; i<nk; ++i) {
+    k[i].s = s;
+    k[i].first = i;
+    k[i].step = nk;
+    k[i].ok = TRUE;
+    k[i].seen = (ub8 *)my_alloc(s, sizeof(ub8)*
+      (size_t)(((total < CONFIRM_BITS ? total : CONFIRM_BITS)+63)/64));
+    k[i].keys = (total > CONFIRM_BITS) ?
+      (ub8 *)my_alloc(s, sizeof(ub8)*(s->ntests+1)) : (ub8 *)0;
+    k[i].pre = (ub8 *)my_alloc(s, sizeof(ub8)*(s->ntests+1));
+    k[i].tally = (ub2 *)my_alloc(s, sizeof(ub2)*(s->nw+1));
+    k[i].tester = (test *)my_alloc(s, sizeof(test));
+    k[i].tester->f = (ub2 *)my_alloc(s, sizeof(ub2)*s->ndim);
+    for (d=0; d<s->ndim; ++d) k[i].tester->f[d] = (ub2)~0;
+  }
+
+#ifdef THREADS
+  for (i=1; i<nk; ++i) {
+    if (pthread_create(&k[i].thread, (pthread_attr_t *)0, 
+		       run_check, (void *)&k[i])) {
+      printf("jenny: could not start a thread\n");
+      cleanup(s);
+      exit(0);
     }
   }
+  (void)run_check((void *)&k[0]);
+  for (i=1; i<nk; ++i) {
+    (void)pthread_join(k[i].thread, (void **)0);
+  }
+#else
+  for (i=0; i<nk; ++i) {
+    (void)run_check((void *)&k[i]);
+  }
+#endif
+
+  /* report the uncovered tuple with the lowest leading dimension */
+  for (i=0, j=nk; i<nk; ++i) {
+    if (!k[i].ok && (j == nk || k[i].bad[0].d < k[j].bad[0].d))
+      j = i;
+  }
+  if (j < nk) {
+    char name[4];
+    name_feature(s, k[j].bad[0].d, k[j].bad[0].f, name);
+    fprintf(note_file(s), "problem with %d%s\n", k[j].bad[0].d+1, name);
+    ok = FALSE;                         /* found a tuple that is not covered */
+  }
 
-  return TRUE;              /* all tuples are covered by a test or a without */
+  for (i=0; i<nk; ++i) {
+    my_free((char *)k[i].seen);
+    if (k[i].keys) my_free((char *)k[i].keys);
+    my_free((char *)k[i].pre);
+    my_free((char *)k[i].tally);
+    my_free((char *)k[i].tester->f);
+    my_free((char *)k[i].tester);
+  }
+  return ok;              /* all tuples are covered by a test or a without */
 }
 
 
@@ -1787,13 +3331,17 @@ void driver( int argc, char *argv[])
 
   initialize(&s);
 
-  if (parse(argc, argv, &s)) {               /* read the user's instructions */
+  if (parse(argc, argv, &s) &&               /* read the user's instructions */
+      (!s.delta || extend_tests(&s))) {  /* -d: fill in new dimensions first */
+    if (s.format != OUT_JENNY)
+      emit_old(&s);              /* -j or -c: stream the -o tests right away */
     cover_tuples(&s);     /* generate testcases until all tuples are covered */
-    /* reduce_tests(&s); */         /* try to reduce the number of testcases */
-    if (confirm(&s))       /* doublecheck that all tuples really are covered */
+    if (s.reduce)
+      reduce_tests(&s);             /* try to reduce the number of testcases */
+    if (!confirm(&s))      /* doublecheck that all tuples really are covered */
+      fprintf(note_file(&s), "jenny: internal error, some tuples not covered\n");
+    else if (s.format == OUT_JENNY)
       report_all(&s);                                  /* report the results */
-    else
-      printf("jenny: internal error, some tuples not covered\n");
   }
   cleanup(&s);                                      /* deallocate everything */
 }
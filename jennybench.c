@@ -0,0 +1,215 @@
+/*
+------------------------------------------------------------------------------
+jennybench.c: time builds of jenny against a fixed set of models.
+Public Domain.
+
+  jennybench [-r3] ./jenny ./jenny_050205 ./jenny_040302 ...
+  (compile with makebench.txt)
+
+Every program named is run on every model below, and for each run this
+reports the wall time, the peak resident memory, and how many testcases
+came out.  The first program is the baseline: the other programs' test
+counts are also shown as a difference from it, so a speedup that costs
+suite size shows up right beside it.  -r3 runs everything 3 times and
+keeps the fastest time.  The models only use -n, -w and -s, so every
+version of jenny back to jenny_030804.c can run them.  Unix only.
+------------------------------------------------------------------------------
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#define MAX_PROGRAMS 16                   /* most programs to compare at once */
+#define MAX_ARGS     128                   /* most arguments a model may have */
+#define LINE_SIZE    4096          /* longest line of jenny output we expect */
+
+/* the models: dimension counts, n=2..4, with and without -w */
+static char *model[] = {
+  "-n2 5 5 5 5 5 5 5 5 5 5",
+  "-n2 10 10 10 10 10 10 10 10 10 10 10 10 10 10 10 10 10 10 10 10",
+  "-n2 4 4 4 4 4 4 4 4 4 4 4 4 4 4 4 4 4 4 4 4 4 4 4 4 4 4 4 4 4 4 4 4 4 4 4 "
+      "4 4 4 4 4 4 4 4 4 4 4 4 4 4 4 4 4 4 4 4 4 4 4 4 4 4 4 4 4 4 4 4 4 4 4 "
+      "4 4 4 4 4 4 4 4 4 4 4 4 4 4 4 4 4 4 4 4 4 4 4 4 4 4 4 4 4 4",
+  "-n2 20 20 20 20 20 20 20 20 -w1a2a -w1b2b3c -w4d5e6f7g -w8h1c",
+  "-n3 4 4 4 4 4 4 4 4 4 4 4 4",
+  "-n3 5 5 5 5 5 5 5 5 5 5 5 5 5 5 5 -s7",
+  "-n3 3 3 3 3 3 3 3 3 3 3 3 3 3 3 3 3 3 3 3 3 -w1a2a -w3b4b5b -w6c7a "
+      "-w10a11b12c",
+  "-n3 2 3 8 -w1a2bc3b -w1b3a 3 -w1a4b 2 2 5 3 2 2 -w9a10b -w3a4b",
+  "-n4 3 3 3 3 3 3 3 3 -w1a2a3a",
+  "-n4 4 4 4 4 4 4 4 4 4 4",
+  "-n4 3 3 3 3 3 3 3 3 3 3 3 3 3 3 3 -w1a2b -w3c4c5c",
+};
+#define NMODELS (sizeof(model)/sizeof(model[0]))
+
+/* what one run of one program on one model did */
+typedef  struct result {
+  double  seconds;                                            /* wall time */
+  long    peak;                           /* peak resident set size, in KB */
+  long    tests;                         /* testcases jenny printed, or -1 */
+} result;
+
+/* split a model into argv for program, in place in buf */
+static void split_args( char *program, char *buf, char **argv)
+{
+  int   argc = 0;
+  char *word;
+
+  argv[argc++] = program;
+  for (word = strtok(buf, " "); word && argc < MAX_ARGS-1;
+       word = strtok((char *)0, " ")) {
+    argv[argc++] = word;
+  }
+  argv[argc] = (char *)0;
+}
+
+/* run program on one model, counting the testcases it prints */
+static void run( char *program, char *args, result *r)
+{
+  char            buf[LINE_SIZE];
+  char           *argv[MAX_ARGS];
+  int             fd[2];
+  int             status;
+  pid_t           pid;
+  struct rusage   ru;
+  struct timeval  start, stop;
+  FILE           *f;
+
+  r->tests = -1;
+  r->peak = 0;
+  r->seconds = 0.0;
+
+  strncpy(buf, args, LINE_SIZE-1);
+  buf[LINE_SIZE-1] = '\0';
+  split_args(program, buf, argv);
+
+  if (pipe(fd) != 0) {
+    perror("jennybench: pipe");
+    exit(1);
+  }
+  fflush(stdout);
+  gettimeofday(&start, (struct timezone *)0);
+  pid = fork();
+  if (pid < 0) {
+    perror("jennybench: fork");
+    exit(1);
+  }
+  if (pid == 0) {                                          /* the child */
+    close(fd[0]);
+    dup2(fd[1], 1);
+    close(fd[1]);
+    execv(program, argv);
+    perror(program);
+    _exit(127);
+  }
+
+  /* testcases are the lines that begin " 1a", jenny's other lines don't */
+  close(fd[1]);
+  f = fdopen(fd[0], "r");
+  r->tests = 0;
+  while (fgets(buf, LINE_SIZE, f)) {
+    if (buf[0] == ' ' && buf[1] >= '0' && buf[1] <= '9')
+      ++r->tests;
+  }
+  fclose(f);
+
+  if (wait4(pid, &status, 0, &ru) < 0) {
+    perror("jennybench: wait4");
+    exit(1);
+  }
+  gettimeofday(&stop, (struct timezone *)0);
+  r->seconds = (stop.tv_sec - start.tv_sec) +
+    (stop.tv_usec - start.tv_usec) / 1000000.0;
+  r->peak = ru.ru_maxrss;                       /* KB on Linux and the BSDs */
+  if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+    r->tests = -1;
+}
+
+static void usage( void)
+{
+  fprintf(stderr, "usage: jennybench [-r<repeats>] program1 program2 ...\n");
+  fprintf(stderr, "  program1 is the baseline.  Example:\n");
+  fprintf(stderr, "  jennybench -r3 ./jenny ./jenny_050205 ./jenny_030804\n");
+  exit(1);
+}
+
+int main( int argc, char **argv)
+{
+  char   *program[MAX_PROGRAMS];
+  result  total[MAX_PROGRAMS];
+  int     nprogram = 0;
+  int     repeats = 1;
+  int     i, j, k;
+
+  for (i=1; i<argc; ++i) {
+    if (argv[i][0] == '-') {
+      if (argv[i][1] != 'r' || (repeats = atoi(&argv[i][2])) < 1)
+	usage();
+    } else if (nprogram == MAX_PROGRAMS) {
+      fprintf(stderr, "jennybench: at most %d programs\n", MAX_PROGRAMS);
+      exit(1);
+    } else {
+      program[nprogram++] = argv[i];
+    }
+  }
+  if (nprogram == 0)
+    usage();
+  for (j=0; j<nprogram; ++j) {
+    total[j].seconds = 0.0;
+    total[j].peak = 0;
+    total[j].tests = 0;
+  }
+
+  printf("%-24s %10s %10s %8s %6s\n",
+	 "program", "seconds", "peak KB", "tests", "+/-");
+  for (i=0; i<(int)NMODELS; ++i) {
+    long base = -1;
+    printf("model %d: %s\n", i+1, model[i]);
+    for (j=0; j<nprogram; ++j) {
+      result best, r;
+      best.seconds = 0.0;
+      best.peak = 0;
+      best.tests = -1;
+      for (k=0; k<repeats; ++k) {
+	run(program[j], model[i], &r);
+	if (k == 0 || r.seconds < best.seconds) best.seconds = r.seconds;
+	if (k == 0 || r.peak > best.peak) best.peak = r.peak;
+	if (k == 0 || r.tests < 0) best.tests = r.tests;
+      }
+      if (best.tests < 0) {
+	printf("%-24s %10s\n", program[j], "failed");
+	total[j].tests = -1;
+	continue;
+      }
+      if (j == 0) base = best.tests;
+      printf("%-24s %10.3f %10ld %8ld", program[j],
+	     best.seconds, best.peak, best.tests);
+      if (j > 0 && base >= 0)
+	printf(" %+6ld", best.tests - base);
+      printf("\n");
+      total[j].seconds += best.seconds;
+      if (best.peak > total[j].peak) total[j].peak = best.peak;
+      if (total[j].tests >= 0) total[j].tests += best.tests;
+    }
+    fflush(stdout);
+  }
+
+  /* sums of time and tests, and the highest peak, over all models */
+  printf("total:\n");
+  for (j=0; j<nprogram; ++j) {
+    printf("%-24s %10.3f %10ld", program[j],
+	   total[j].seconds, total[j].peak);
+    if (total[j].tests < 0)
+      printf(" %8s", "failed");
+    else
+      printf(" %8ld", total[j].tests);
+    if (j > 0 && total[0].tests >= 0 && total[j].tests >= 0)
+      printf(" %+6ld", total[j].tests - total[0].tests);
+    printf("\n");
+  }
+  return 0;
+}
@@ -0,0 +1,360 @@
+/*
+------------------------------------------------------------------------------
+perfbdz.c: build a perfect hash for huge key sets by 3-hypergraph peeling.
+You may use this code in any way you wish, and it is free.  No warranty.
+
+This is the construction of Botelho, Pagh and Ziviani ("Simple and Space-
+Efficient Minimal Perfect Hash Functions", 2007), usually called BDZ.
+Every key is an edge joining three vertices, one in each third of 3*r
+vertices, where 3*r is about BDZ_RATIO times the number of keys.  If the
+graph can be peeled (repeatedly remove an edge that has a vertex no other
+edge uses) then walking the removed edges in reverse gives each edge a
+vertex of its own, and a 2-bit value g[] per vertex records which of its
+three vertices each edge owns:
+  hash(key) = v[(g[v[0]] + g[v[1]] + g[v[2]]) % 3]
+That is a perfect hash into 0..3r-1.  For a minimal perfect hash, vertices
+nobody owns keep g=3, and the hash is the number of owned vertices before
+it, found from a count stored every BDZ_RANK vertices plus the g[] between.
+Space is 2 bits per vertex plus the counts, about 2.6 bits per key, and
+time is linear in the number of keys.  Unlike perfect() there is no tabq,
+tabh or list of keys per b, and no 16-bit limit on tab[] values.
+------------------------------------------------------------------------------
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#ifndef STANDARD
+#include "standard.h"
+#endif
+#ifndef LOOKUPA
+#include "lookupa.h"
+#endif
+#ifndef RECYCLE
+#include "recycle.h"
+#endif
+#ifndef PERFECT
+#include "perfect.h"
+#endif
+
+#define BDZ_RATIO   1.23            /* vertices per key, peelable above 1.222 */
+#define BDZ_RETRY   8                /* failed salts before growing the graph */
+
+/* the 2-bit value of vertex v in g[] */
+#define bdzg(g,v)  (((g)[(v)>>2] >> (((v)&3)<<1)) & 3)
+
+/* map the three hashes of a key to its three vertices */
+static void bdzedge(name, len, salt, r, v)
+ub1 *name;
+ub4  len;
+ub4  salt;
+ub4  r;                                        /* vertices per third of g */
+ub4 *v;                                           /* output, three vertices */
+{
+  ub4 i, state[CHECKSTATE];
+  ub4 initlev = salt*0x9e3779b9;    /* the golden ratio; an arbitrary value */
+
+  for (i=0; i<CHECKSTATE; ++i) state[i] = initlev;
+  checksum(name, len, state);
+  for (i=0; i<3; ++i)
+    v[i] = (ub4)((((ub8)(state[i]&0xffffffff))*r)>>32) + i*r;
+}
+
+/* what the threads hashing keys to edges share */
+struct bdzwork
+{
+  key **keyv;                                 /* keyv[e] is the key of edge e */
+  ub4  *edge;                                  /* output, 3 vertices per edge */
+  ub4   salt;
+  ub4   r;                                     /* vertices per third of g */
+};
+typedef  struct bdzwork  bdzwork;
+
+/* the edges of keys lo..hi-1 */
+static void bdzedges(arg, lo, hi)
+void *arg;
+ub4   lo;
+ub4   hi;
+{
+  bdzwork *w = (bdzwork *)arg;
+  ub4      e;
+  for (e=lo; e<hi; ++e)
+    bdzedge(w->keyv[e]->name_k, w->keyv[e]->len_k, w->salt, w->r, 
+	    &w->edge[3*e]);
+}
+
+/*
+ * Peel the graph.  Returns TRUE if every edge got peeled, and then
+ * peel[0..nkeys-1] are the edges in the order they were removed and
+ * which[e] is the position (0,1,2) of the vertex edge e owns.
+ */
+static int bdzpeel(edge, nkeys, nvert, deg, xr, stack, peel, which)
+ub4 *edge;                                   /* three vertices for each edge */
+ub4  nkeys;
+ub4  nvert;                                            /* number of vertices */
+ub4 *deg;                                 /* scratch, degree of each vertex */
+ub4 *xr;          /* scratch, xor of the edges still touching each vertex */
+ub4 *stack;                 /* scratch, vertices that may have degree 1 */
+ub4 *peel;                                  /* output, edges in peel order */
+ub1 *which;                       /* output, which vertex each edge owns */
+{
+  ub4 e, i, v, top, npeel;
+
+  memset((void *)deg, 0, sizeof(ub4)*nvert);
+  memset((void *)xr, 0, sizeof(ub4)*nvert);
+  for (e=0; e<nkeys; ++e)
+    for (i=0; i<3; ++i)
+    {
+      ++deg[edge[3*e+i]];
+      xr[edge[3*e+i]] ^= e;
+    }
+
+  /* a vertex reaches degree 1 at most once, so stack holds nvert */
+  for (top=0, v=0; v<nvert; ++v)
+    if (deg[v] == 1) stack[top++] = v;
+
+  npeel = 0;
+  while (top)
+  {
+    v = stack[--top];
+    if (deg[v] != 1) continue;                /* its edge was peeled already */
+    e = xr[v];
+    peel[npeel++] = e;
+    for (i=0; i<3; ++i)
+    {
+      ub4 u = edge[3*e+i];
+      if (u == v) which[e] = (ub1)i;
+      xr[u] ^= e;
+      if (--deg[u] == 1) stack[top++] = u;
+    }
+  }
+  return (npeel == nkeys);
+}
+
+/* Find a BDZ perfect hash of the keys; fill in *b */
+void findbdz(b, keys, nkeys, form)
+bdz      *b;                                    /* output, the perfect hash */
+key      *keys;                                       /* input, keys to hash */
+ub4       nkeys;                       /* input, number of keys being hashed */
+hashform *form;                                           /* user directives */
+{
+  key **keyv;                                   /* keyv[e] is the key of edge e */
+  key  *mykey;
+  ub4  *edge;                                /* three vertices for each edge */
+  ub4  *deg, *xr, *stack, *peel;
+  ub1  *which;
+  ub4   nvert, e, i, v, trysalt, bad;
+  bdzwork w;
+
+  dupkeys(keys, nkeys, form);
+  keyv  = (key **)remalloc(sizeof(key *)*(nkeys+1), "perfbdz.c, keyv");
+  edge  = (ub4 *)remalloc(sizeof(ub4)*3*(nkeys+1), "perfbdz.c, edge");
+  peel  = (ub4 *)remalloc(sizeof(ub4)*(nkeys+1), "perfbdz.c, peel");
+  which = (ub1 *)remalloc(sizeof(ub1)*(nkeys+1), "perfbdz.c, which");
+  for (e=0, mykey=keys; mykey; mykey=mykey->next_k) keyv[e++] = mykey;
+  w.keyv = keyv;
+  w.edge = edge;
+
+  b->r = (ub4)(BDZ_RATIO*nkeys/3) + 1;
+  deg = xr = stack = (ub4 *)0;
+  b->g = (ub1 *)0;
+  bad = 0;
+  for (trysalt=1; ; ++trysalt)
+  {
+    if (!deg)
+    {
+      nvert = 3*b->r;
+      deg   = (ub4 *)remalloc(sizeof(ub4)*nvert, "perfbdz.c, deg");
+      xr    = (ub4 *)remalloc(sizeof(ub4)*nvert, "perfbdz.c, xr");
+      stack = (ub4 *)remalloc(sizeof(ub4)*nvert, "perfbdz.c, stack");
+    }
+    w.salt = trysalt;
+    w.r = b->r;
+    parfor(nkeys, bdzedges, (void *)&w, form->threads);
+    if (bdzpeel(edge, nkeys, nvert, deg, xr, stack, peel, which))
+      break;
+
+    if (++bad >= BDZ_RETRY)
+    {                  /* tiny graphs peel less reliably, so make it bigger */
+      b->r += b->r/16 + 1;
+      free((void *)deg);
+      free((void *)xr);
+      free((void *)stack);
+      deg = (ub4 *)0;
+      bad = 0;
+    }
+  }
+  printf("found a peelable graph on attempt %ld\n", trysalt);
+  b->salt = trysalt;
+
+  /* g[] is padded to a whole number of rank blocks, unused vertices are 3 */
+  b->nrank = (nvert+BDZ_RANK-1)/BDZ_RANK;
+  b->glen = b->nrank*(BDZ_RANK/4);
+  b->g = (ub1 *)remalloc((size_t)b->glen, "perfbdz.c, g");
+  memset((void *)b->g, 0xff, (size_t)b->glen);
+
+  /* in reverse peel order, each edge owns a vertex no later edge touched */
+  for (i=nkeys; i--;)
+  {
+    ub4  w = which[peel[i]];
+    ub4 *ve = &edge[3*peel[i]];
+    ub4  sum = bdzg(b->g, ve[(w+1)%3]) + bdzg(b->g, ve[(w+2)%3]);
+    v = ve[w];
+    b->g[v>>2] &= ~(3<<((v&3)<<1));
+    b->g[v>>2] |= ((w+6-sum)%3)<<((v&3)<<1);
+  }
+
+  /* count owned vertices before each rank block */
+  b->rank = (ub4 *)0;
+  if (form->perfect == MINIMAL_HP)
+  {
+    ub4 count = 0;
+    b->rank = (ub4 *)remalloc(sizeof(ub4)*b->nrank, "perfbdz.c, rank");
+    for (v=0; v<b->nrank*BDZ_RANK; ++v)
+    {
+      if (v%BDZ_RANK == 0) b->rank[v/BDZ_RANK] = count;
+      if (bdzg(b->g, v) != 3) ++count;
+    }
+  }
+  printf("built perfect hash table of size %ld\n", nvert);
+
+  free((void *)keyv);
+  free((void *)edge);
+  free((void *)peel);
+  free((void *)which);
+  free((void *)deg);
+  free((void *)xr);
+  free((void *)stack);
+}
+
+/* the hash the generated phash() gives a key, for phashmap[] */
+static ub4 bdzhash(b, name, len, form)
+bdz      *b;                                            /* the perfect hash */
+ub1      *name;
+ub4       len;
+hashform *form;                                           /* user directives */
+{
+  ub4 v[3], u, rsl;
+
+  bdzedge(name, len, b->salt, b->r, v);
+  rsl = v[(bdzg(b->g, v[0]) + bdzg(b->g, v[1]) + bdzg(b->g, v[2])) % 3];
+  if (form->perfect == MINIMAL_HP)
+  {
+    u = rsl;
+    rsl = b->rank[u/BDZ_RANK];
+    for (v[0]=u&~(BDZ_RANK-1); v[0]<u; ++v[0])
+      if (bdzg(b->g, v[0]) != 3) ++rsl;
+  }
+  return rsl;
+}
+
+/* Write phash.h and phash.c for a BDZ perfect hash */
+void make_bdz(b, keys, nkeys, form)
+bdz      *b;                                            /* the perfect hash */
+key      *keys;                                          /* list of all keys */
+ub4       nkeys;                                /* number of keys hashed */
+hashform *form;                                           /* user directives */
+{
+  FILE *f;
+  ub4   i;
+  ub4   maplen = (form->perfect == MINIMAL_HP) ? nkeys : 3*b->r;
+
+  f = fopen("phash.h", "w");
+  fprintf(f, "/* Perfect hash definitions */\n");
+  fprintf(f, "#ifndef STANDARD\n");
+  fprintf(f, "#include \"standard.h\"\n");
+  fprintf(f, "#endif /* STANDARD */\n");
+  fprintf(f, "#ifndef PHASH\n");
+  fprintf(f, "#define PHASH\n");
+  fprintf(f, "\n");
+  fprintf(f, "extern ub1 tab[];\n");
+  if (form->perfect == MINIMAL_HP)
+    fprintf(f, "extern ub4 rank[];\n");
+  fprintf(f, "#define PHASHLEN 0x%lx  /* length of hash mapping table */\n",
+	  b->glen);
+  fprintf(f, "#define PHASHNKEYS %ld  /* How many keys were hashed */\n",
+          nkeys);
+  fprintf(f, "#define PHASHRANGE %ld  /* Range any input might map to */\n",
+          (form->perfect == MINIMAL_HP) ? nkeys : 3*b->r);
+  fprintf(f, "#define PHASHSALT 0x%.8lx /* internal, initialize normal hash */\n",
+          b->salt*0x9e3779b9);
+  fprintf(f, "#define PHASHR %ld  /* vertices in each third of tab */\n",
+	  b->r);
+  fprintf(f, "\n");
+  fprintf(f, "ub4 phash();\n");
+  fprintf(f, "\n");
+  if (form->keymap)
+    make_map_h(f, maplen, form);
+  fprintf(f, "#endif  /* PHASH */\n");
+  fprintf(f, "\n");
+  fclose(f);
+  printf("Wrote phash.h\n");
+
+  f = fopen("phash.c", "w");
+  fprintf(f, "/* table for the mapping for the perfect hash */\n");
+  fprintf(f, "#ifndef STANDARD\n");
+  fprintf(f, "#include \"standard.h\"\n");
+  fprintf(f, "#endif /* STANDARD */\n");
+  fprintf(f, "#ifndef PHASH\n");
+  fprintf(f, "#include \"phash.h\"\n");
+  fprintf(f, "#endif /* PHASH */\n");
+  fprintf(f, "#ifndef LOOKUPA\n");
+  fprintf(f, "#include \"lookupa.h\"\n");
+  fprintf(f, "#endif /* LOOKUPA */\n");
+  fprintf(f, "\n");
+  fprintf(f, "/* 2 bits per vertex: which of its 3 vertices a key uses */\n");
+  fprintf(f, "ub1 tab[] = {\n");
+  for (i=0; i<b->glen; ++i)
+    fprintf(f, "%ld,%s", (ub4)b->g[i], (i%16 == 15) ? "\n" : "");
+  fprintf(f, "};\n");
+  fprintf(f, "\n");
+  if (form->perfect == MINIMAL_HP)
+  {
+    fprintf(f, "/* used vertices before every %ldth vertex */\n",
+	    (ub4)BDZ_RANK);
+    fprintf(f, "ub4 rank[] = {\n");
+    for (i=0; i<b->nrank; ++i)
+      fprintf(f, "%ld,%s", b->rank[i], (i%8 == 7) ? "\n" : "");
+    fprintf(f, "};\n");
+    fprintf(f, "\n");
+  }
+  fprintf(f, "#define PHASHG(v) ((tab[(v)>>2] >> (((v)&3)<<1)) & 3)\n");
+  fprintf(f, "\n");
+  fprintf(f, "/* The hash function */\n");
+  fprintf(f, "ub4 phash(key, len)\n");
+  fprintf(f, "char *key;\n");
+  fprintf(f, "int   len;\n");
+  fprintf(f, "{\n");
+  fprintf(f, "  ub4 i,state[CHECKSTATE],v[3],rsl;\n");
+  fprintf(f, "  for (i=0; i<CHECKSTATE; ++i) state[i]=PHASHSALT;\n");
+  fprintf(f, "  checksum(key, len, state);\n");
+  fprintf(f, "  for (i=0; i<3; ++i)\n");
+  fprintf(f, "    v[i] = (ub4)((((ub8)(state[i]&0xffffffff))*PHASHR)>>32) + i*PHASHR;\n");
+  fprintf(f, "  rsl = v[(PHASHG(v[0]) + PHASHG(v[1]) + PHASHG(v[2])) %% 3];\n");
+  if (form->perfect == MINIMAL_HP)
+  {
+    fprintf(f, "  v[0] = rsl;\n");
+    fprintf(f, "  rsl = rank[v[0]/%ld];\n", (ub4)BDZ_RANK);
+    fprintf(f, "  for (i=(v[0]&~%ld)>>2; i<(v[0]>>2); ++i)\n", 
+	    (ub4)(BDZ_RANK-1));
+    fprintf(f, "  {\n");
+    fprintf(f, "    v[1] = tab[i] & (tab[i]>>1) & 0x55;  /* 1 per unused vertex */\n");
+    fprintf(f, "    rsl += 4 - (v[1]&1) - ((v[1]>>2)&1) - ((v[1]>>4)&1) - (v[1]>>6);\n");
+    fprintf(f, "  }\n");
+    fprintf(f, "  for (i=v[0]&~3; i<v[0]; ++i)\n");
+    fprintf(f, "    if (PHASHG(i) != 3) ++rsl;\n");
+  }
+  fprintf(f, "  return rsl;\n");
+  fprintf(f, "}\n");
+  fprintf(f, "\n");
+  if (form->keymap)
+  {
+    ub4 *rsl = (ub4 *)remalloc(sizeof(ub4)*(nkeys+1), "perfbdz.c, rsl");
+    key *mykey;
+    for (i=0, mykey=keys; mykey; ++i, mykey=mykey->next_k)
+      rsl[i] = bdzhash(b, mykey->name_k, mykey->len_k, form);
+    make_map_c(f, keys, rsl, maplen, form);
+    free((void *)rsl);
+  }
+  fclose(f);
+  printf("Wrote phash.c\n");
+}
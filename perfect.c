@@ -46,6 +46,8 @@ determined a perfect hash for the whole set of keys.
 ------------------------------------------------------------------------------
 */
 
+#include <stdlib.h>
+#include <string.h>
 #ifndef STANDARD
 #include "standard.h"
 #endif
@@ -58,6 +60,13 @@ determined a perfect hash for the whole set of keys.
 #ifndef PERFECT
 #include "perfect.h"
 #endif
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#ifdef THREADS
+#include <pthread.h>
+#endif
 
 /*
 ------------------------------------------------------------------------------
@@ -98,7 +107,7 @@ ub4 nbits;                                 /* input, number of bits in range */
 }
 
 /* initialize scramble[] with distinct random values in 0..smax-1 */
-static void scrambleinit(scramble, smax)
+void scrambleinit(scramble, smax)
 ub4      *scramble;                            /* hash is a^scramble[tab[b]] */
 ub4       smax;                    /* scramble values should be in 0..smax-1 */
 {
@@ -138,6 +147,13 @@ hashform *form;
       exit(SUCCESS);
     }
     break;
+  case INT8_HT:
+    if (key1->hash8_k == key2->hash8_k)
+    {
+      fprintf(stderr, "perfect.c: Duplicate keys!  %.16llx\n", key1->hash8_k);
+      exit(SUCCESS);
+    }
+    break;
   case AB_HT:
     fprintf(stderr, "perfect.c: Duplicate keys!  %.8lx %.8lx\n",
 	    key1->a_k, key1->b_k);
@@ -155,14 +171,12 @@ hashform *form;
  * put keys in tabb according to key->b_k
  * check if the initial hash might work 
  */
-static int inittab(tabb, blen, keys, form, complete)
+static int inittab(tabb, blen, keys, form)
 bstuff   *tabb;                     /* output, list of keys with b for (a,b) */
 ub4       blen;                                            /* length of tabb */
 key      *keys;                               /* list of keys already hashed */
 hashform *form;                                           /* user directives */
-int       complete;        /* TRUE means to complete init despite collisions */
 {
-  int  nocollision = TRUE;
   key *mykey;
 
   memset((void *)tabb, 0, (size_t)(sizeof(bstuff)*blen));
@@ -178,10 +192,8 @@ int       complete;        /* TRUE means to complete init despite collisions */
     {
       if (mykey->a_k == otherkey->a_k)
       {
-        nocollision = FALSE;
 	checkdup(mykey, otherkey, form);
-	if (!complete)
-	  return FALSE;
+	return FALSE;
       }
     }
     ++tabb[mykey->b_k].listlen_b;
@@ -190,7 +202,7 @@ int       complete;        /* TRUE means to complete init despite collisions */
   }
 
   /* no two keys have the same (a,b) pair */
-  return nocollision;
+  return TRUE;
 }
 
 
@@ -343,6 +355,10 @@ gencode  *final;                                      /* code for final hash */
     finished = inithex(keys, nkeys, alen, blen, smax, salt, final, form); 
     if (finished) return 2;
     break;
+  case HEX8_HM:
+  case DECIMAL8_HM:
+    inithex8(keys, alen, blen, smax, salt, final);
+    break;
   default:
     fprintf(stderr, "fatal error: illegal mode\n"); 
     exit(1);
@@ -355,27 +371,7 @@ gencode  *final;                                      /* code for final hash */
     return 2;
   }
 
-  return inittab(tabb, blen, keys, form, FALSE);
-}
-
-/* Print an error message and exit if there are duplicates */
-static void duplicates(tabb, blen, keys, form)
-bstuff   *tabb;                    /* array of lists of keys with the same b */
-ub4       blen;                              /* length of tabb, a power of 2 */
-key      *keys;
-hashform *form;                                           /* user directives */
-{
-  ub4  i;
-  key *key1;
-  key *key2;
-
-  (void)inittab(tabb, blen, keys, form, TRUE);
-
-  /* for each b, do nested loops through key list looking for duplicates */
-  for (i=0; i<blen; ++i)
-    for (key1=tabb[i].list_b; key1; key1=key1->nextb_k)
-      for (key2=key1->nextb_k; key2; key2=key2->nextb_k)
-	checkdup(key1, key2, form);
+  return inittab(tabb, blen, keys, form);
 }
 
 
@@ -542,7 +538,8 @@ hashform *form;               /* TRUE if we should do a minimal perfect hash */
 
 
 /* find a mapping that makes this a perfect hash */
-static int perfect(tabb, tabh, tabq, blen, smax, scramble, nkeys, form)
+static int perfect(tabb, tabh, tabq, blen, smax, scramble, nkeys, form,
+		   failsize)
 bstuff   *tabb;
 hstuff   *tabh;
 qstuff   *tabq;
@@ -551,6 +548,7 @@ ub4       smax;
 ub4      *scramble;
 ub4       nkeys;
 hashform *form;
+ub4      *failsize;         /* output, size of the group that failed to map */
 {
   ub4 maxkeys;                           /* maximum number of keys for any b */
   ub4 i, j;
@@ -572,7 +570,7 @@ hashform *form;
 	if (!augment(tabb, tabh, tabq, blen, scramble, smax, &tabb[i], nkeys, 
 		     i+1, form))
 	{
-	  printf("fail to map group of size %ld for tab size %ld\n", j, blen);
+	  *failsize = j;
 	  return FALSE;
 	}
 
@@ -602,6 +600,7 @@ hashform *form;                                           /* user directives */
   qstuff *tabq;
   key    *mykey;
   ub4     i;
+  ub4     failsize;
   int     used_tab;
 
   /* initially make smax the first power of two bigger than nkeys */
@@ -633,11 +632,14 @@ hashform *form;                                           /* user directives */
 			     "perfect.c, tabh");
 
   /* check that (a,b) are distinct and put them in tabb indexed by b */
-  (void)inittab(*tabb, *blen, keys, form, FALSE);
+  (void)inittab(*tabb, *blen, keys, form);
 
   /* try with smax */
-  if (!perfect(*tabb, tabh, tabq, *blen, *smax, scramble, nkeys, form))
+  if (!perfect(*tabb, tabh, tabq, *blen, *smax, scramble, nkeys, form,
+	       &failsize))
   {
+    printf("fail to map group of size %ld for tab size %ld\n", 
+	   failsize, *blen);
     if (form->perfect == MINIMAL_HP)
     {
       printf("fatal error: Cannot find perfect hash for user (A,B) pairs\n");
@@ -652,8 +654,11 @@ hashform *form;                                           /* user directives */
       tabh = (hstuff *)remalloc(sizeof(hstuff)*(form->perfect == MINIMAL_HP ?
 						nkeys : *smax),
 				"perfect.c, tabh");
-      if (!perfect(*tabb, tabh, tabq, *blen, *smax, scramble, nkeys, form))
+      if (!perfect(*tabb, tabh, tabq, *blen, *smax, scramble, nkeys, form,
+		   &failsize))
       {
+	printf("fail to map group of size %ld for tab size %ld\n", 
+	       failsize, *blen);
 	printf("fatal error: Cannot find perfect hash for user (A,B) pairs\n");
 	exit(SUCCESS);
       }
@@ -819,6 +824,345 @@ hashform *form;                                           /* user directives */
   }
 }
 
+#ifdef THREADS
+/*
+------------------------------------------------------------------------------
+Parallel salt search.
+
+Each salt is tried independently of the others, so a round of salts
+  trysalt..trysalt+nthreads-1 is handed to nthreads threads, each with its
+  own copy of the keys and its own tabb, tabh, tabq and final hash code.
+  findhash then walks the results in salt order exactly as if it had
+  tried them itself, and throws away the rest of a round once alen or
+  blen changes.  So the salt that wins, and everything printed, is the
+  same as for the sequential search.  The winning salt is redone on
+  findhash's own tables.  Only NORMAL_HM and INLINE_HM search salts this
+  way; the hex modes keep state across salts in inithex.
+------------------------------------------------------------------------------
+*/
+
+/* everything one thread writes while trying one salt */
+struct salter
+{
+  struct saltpool *pool;
+  key      *keys;                     /* this thread's private copy of keys */
+  bstuff   *tabb;
+  hstuff   *tabh;
+  qstuff   *tabq;
+  ub4       blen;                         /* tabb and tabq fit this blen */
+  gencode   final;
+  char     *line[10];
+  char      buf[10][80];
+  ub4       salt;                                       /* the salt to try */
+  ub4       result;     /* 0 no distinct (a,b), 1 perfect failed, 2 success */
+  ub4       failsize;                    /* group size perfect failed on */
+  pthread_t thread;
+};
+typedef  struct salter  salter;
+
+struct saltpool
+{
+  salter   *w;                                  /* one salter per thread */
+  ub4       nthreads;
+  ub4       first;                        /* w[i] tried salt first+i */
+  ub4       alen;                /* ... with this alen and blen, 0 if none */
+  ub4       blen;
+  ub4       smax;
+  ub4      *scramble;
+  ub4       nkeys;
+  hashform *form;
+};
+typedef  struct saltpool  saltpool;
+
+static void *saltwork(arg)
+void *arg;
+{
+  salter   *w = (salter *)arg;
+  saltpool *p = w->pool;
+
+  w->result = initkey(w->keys, p->nkeys, w->tabb, p->alen, p->blen, p->smax,
+		      w->salt, p->form, &w->final);
+  if (w->result == 1 &&
+      perfect(w->tabb, w->tabh, w->tabq, p->blen, p->smax, p->scramble,
+	      p->nkeys, p->form, &w->failsize))
+    w->result = 2;
+  return (void *)0;
+}
+
+static saltpool *saltinit(nthreads, keys, nkeys, smax, scramble, form)
+ub4       nthreads;
+key      *keys;
+ub4       nkeys;
+ub4       smax;
+ub4      *scramble;
+hashform *form;
+{
+  saltpool *p = (saltpool *)remalloc(sizeof(saltpool), "perfect.c, pool");
+  ub4       i, j;
+
+  p->w = (salter *)remalloc(sizeof(salter)*nthreads, "perfect.c, salters");
+  p->nthreads = nthreads;
+  p->first = 0;
+  p->alen = p->blen = 0;
+  p->smax = smax;
+  p->scramble = scramble;
+  p->nkeys = nkeys;
+  p->form = form;
+  for (i=0; i<nthreads; ++i)
+  {
+    salter *w = &p->w[i];
+    key    *mykey;
+
+    w->pool = p;
+    w->keys = (key *)remalloc(sizeof(key)*nkeys, "perfect.c, salter keys");
+    for (j=0, mykey=keys; mykey; mykey=mykey->next_k, ++j)
+    {                              /* keep the order, it affects the result */
+      w->keys[j] = *mykey;
+      w->keys[j].next_k = (j+1 < nkeys) ? &w->keys[j+1] : (key *)0;
+    }
+    w->tabb = (bstuff *)0;
+    w->tabq = (qstuff *)0;
+    w->blen = 0;
+    w->tabh = (hstuff *)remalloc(sizeof(hstuff)*
+				 (form->perfect == MINIMAL_HP ? nkeys : smax),
+				 "perfect.c, salter tabh");
+    w->final.line = w->line;
+    w->final.len = 10;
+    w->final.used = 0;
+    for (j=0; j<10; ++j) w->line[j] = w->buf[j];
+  }
+  return p;
+}
+
+static void saltfree(p)
+saltpool *p;
+{
+  ub4 i;
+  for (i=0; i<p->nthreads; ++i)
+  {
+    free((void *)p->w[i].keys);
+    free((void *)p->w[i].tabh);
+    if (p->w[i].tabb) free((void *)p->w[i].tabb);
+    if (p->w[i].tabq) free((void *)p->w[i].tabq);
+  }
+  free((void *)p->w);
+  free((void *)p);
+}
+
+/* the result of trying trysalt with alen and blen, trying a round if needed */
+static salter *saltget(p, trysalt, alen, blen)
+saltpool *p;
+ub4       trysalt;
+ub4       alen;
+ub4       blen;
+{
+  ub4 i;
+
+  if (p->alen != alen || p->blen != blen ||
+      trysalt < p->first || trysalt >= p->first + p->nthreads)
+  {
+    p->first = trysalt;
+    p->alen = alen;
+    p->blen = blen;
+    for (i=0; i<p->nthreads; ++i)
+    {
+      salter *w = &p->w[i];
+      w->salt = trysalt+i;
+      if (w->blen < blen)
+      {
+	if (w->tabb) free((void *)w->tabb);
+	if (w->tabq) free((void *)w->tabq);
+	w->tabb = (bstuff *)remalloc(sizeof(bstuff)*blen, "perfect.c, tabb");
+	w->tabq = (qstuff *)remalloc(sizeof(qstuff)*(blen+1),
+				     "perfect.c, tabq");
+	w->blen = blen;
+      }
+    }
+    for (i=1; i<p->nthreads; ++i)
+      if (pthread_create(&p->w[i].thread, (pthread_attr_t *)0,
+			 saltwork, (void *)&p->w[i]))
+      {
+	fprintf(stderr, "perfect.c: could not start a thread\n");
+	exit(SUCCESS);
+      }
+    (void)saltwork((void *)&p->w[0]);
+    for (i=1; i<p->nthreads; ++i)
+      (void)pthread_join(p->w[i].thread, (void **)0);
+  }
+  return &p->w[trysalt - p->first];
+}
+#endif /* THREADS */
+
+/*
+------------------------------------------------------------------------------
+Parallel loops over the keys.
+
+parfor(n, fn, arg, nthreads) calls fn(arg, lo, hi) for slices lo..hi-1
+  of 0..n-1, one slice per thread, and returns when they are all done.
+  Slices get at least PARFOR_MIN items; without THREADS it is simply
+  fn(arg, 0, n).  fn must not write anything another slice reads.
+------------------------------------------------------------------------------
+*/
+
+#ifdef THREADS
+/* one thread's slice of a parfor */
+struct parslice
+{
+  void     (*fn)();
+  void      *arg;
+  ub4        lo;
+  ub4        hi;
+  pthread_t  thread;
+};
+typedef  struct parslice  parslice;
+
+static void *parwork(arg)
+void *arg;
+{
+  parslice *s = (parslice *)arg;
+  (*s->fn)(s->arg, s->lo, s->hi);
+  return (void *)0;
+}
+#endif /* THREADS */
+
+void parfor(n, fn, arg, nthreads)
+ub4    n;                                   /* do items 0..n-1 */
+void (*fn)();                               /* fn(arg, lo, hi) does lo..hi-1 */
+void  *arg;
+ub4    nthreads;                              /* most threads to use at once */
+{
+#ifdef THREADS
+  if (nthreads > n/PARFOR_MIN) nthreads = n/PARFOR_MIN;
+  if (nthreads > 1)
+  {
+    parslice *s = (parslice *)remalloc(sizeof(parslice)*nthreads, 
+				       "perfect.c, parfor");
+    ub4       i;
+
+    for (i=0; i<nthreads; ++i)
+    {
+      s[i].fn  = fn;
+      s[i].arg = arg;
+      s[i].lo  = (ub4)(((ub8)n*i)/nthreads);
+      s[i].hi  = (ub4)(((ub8)n*(i+1))/nthreads);
+    }
+    for (i=1; i<nthreads; ++i)
+      if (pthread_create(&s[i].thread, (pthread_attr_t *)0, 
+			 parwork, (void *)&s[i]))
+      {
+	fprintf(stderr, "perfect.c: could not start a thread\n");
+	exit(SUCCESS);
+      }
+    (void)parwork((void *)&s[0]);
+    for (i=1; i<nthreads; ++i)
+      (void)pthread_join(s[i].thread, (void **)0);
+    free((void *)s);
+    return;
+  }
+#endif /* THREADS */
+  (*fn)(arg, (ub4)0, n);
+}
+
+/*
+------------------------------------------------------------------------------
+Find duplicate keys before searching for a hash.
+
+No salt can separate two copies of a key, but the salt search only
+  notices when the copies are the first pair of keys to collide, which
+  with many keys may take thousands of salts or never happen.  So give
+  every key a 64-bit fingerprint (the key itself for integer keys), put
+  the fingerprints in a hash table, and compare keys whose fingerprints
+  match.  That is one pass, a sort of millions of keys took longer than
+  the search it was guarding.
+------------------------------------------------------------------------------
+*/
+
+/* a key and its fingerprint */
+struct keyfp
+{
+  ub8  fp;
+  key *k;
+};
+typedef  struct keyfp  keyfp;
+
+/* what the threads of dupkeys share */
+struct dupwork
+{
+  keyfp    *fpv;                                 /* fpv[i].k is set already */
+  hashform *form;
+};
+typedef  struct dupwork  dupwork;
+
+/* fill in the fingerprints of fpv[lo..hi-1] */
+static void dupfp(arg, lo, hi)
+void *arg;
+ub4   lo;
+ub4   hi;
+{
+  dupwork *w = (dupwork *)arg;
+  ub4      i, j, state[CHECKSTATE];
+
+  for (i=lo; i<hi; ++i)
+  {
+    key *mykey = w->fpv[i].k;
+    switch (w->form->hashtype)
+    {
+    case STRING_HT:
+      for (j=0; j<CHECKSTATE; ++j) state[j] = 0;
+      checksum(mykey->name_k, mykey->len_k, state);
+      w->fpv[i].fp = (((ub8)(state[0]&0xffffffff))<<32) | 
+	(state[1]&0xffffffff);
+      break;
+    case INT8_HT:
+      w->fpv[i].fp = mykey->hash8_k;
+      break;
+    case AB_HT:
+      w->fpv[i].fp = (((ub8)(mykey->a_k&0xffffffff))<<32) | 
+	(mykey->b_k&0xffffffff);
+      break;
+    default:
+      w->fpv[i].fp = mykey->hash_k;
+      break;
+    }
+  }
+}
+
+/* Print an error message and exit if any two keys are the same */
+void dupkeys(keys, nkeys, form)
+key      *keys;                                          /* list of all keys */
+ub4       nkeys;                                           /* number of keys */
+hashform *form;                                           /* user directives */
+{
+  dupwork w;
+  key    *mykey;
+  ub4    *slot;                /* open addressing, 1+i for fpv[i], 0 if empty */
+  ub4     i, j, logn;
+
+  if (nkeys <= 1) return;
+  w.fpv  = (keyfp *)remalloc(sizeof(keyfp)*nkeys, "perfect.c, fpv");
+  w.form = form;
+  for (i=0, mykey=keys; mykey; mykey=mykey->next_k) w.fpv[i++].k = mykey;
+  parfor(nkeys, dupfp, (void *)&w, form->threads);
+
+  /* integer keys are often sequential, so scatter them before masking */
+  logn = mylog2(nkeys)+1;
+  slot = (ub4 *)remalloc(sizeof(ub4)*((size_t)1<<logn), "perfect.c, slot");
+  memset((void *)slot, 0, sizeof(ub4)*((size_t)1<<logn));
+  for (i=0; i<nkeys; ++i)
+  {
+    for (j = (ub4)((w.fpv[i].fp*0x9e3779b97f4a7c15LL) >> (64-logn));
+	 slot[j];
+	 j = (j+1) & (((ub4)1<<logn)-1))
+    {               /* for strings, equal fingerprints may not be equal keys */
+      if (w.fpv[slot[j]-1].fp == w.fpv[i].fp)
+	checkdup(w.fpv[slot[j]-1].k, w.fpv[i].k, form);
+    }
+    slot[j] = i+1;
+  }
+  free((void *)slot);
+  free((void *)w.fpv);
+}
+
 /* 
 ** Try to find a perfect hash function.  
 ** Return the successful initializer for the initial hash. 
@@ -841,8 +1185,15 @@ hashform *form;                                           /* user directives */
   ub4 bad_perfect;                       /* how many times did perfect fail? */
   ub4 trysalt;                        /* trial initializer for initial hash */
   ub4 maxalen;
+  ub4 failsize;                      /* size of the group perfect can't map */
   hstuff *tabh;                       /* table of keys indexed by hash value */
   qstuff *tabq;    /* table of stuff indexed by queue value, used by augment */
+#ifdef THREADS
+  saltpool *pool = (saltpool *)0;         /* threads that try salts for us */
+  salter   *tried;                  /* what a thread found for this salt */
+#endif
+
+  dupkeys(keys, nkeys, form);
 
   /* The case of (A,B) supplied by the user is a special case */
   if (form->hashtype == AB_HT)
@@ -868,6 +1219,13 @@ hashform *form;                                           /* user directives */
 					     nkeys : *smax),
 			     "perfect.c, tabh");
 
+#ifdef THREADS
+  if (form->threads > 1 && nkeys > 1 &&
+      (form->mode == NORMAL_HM || form->mode == INLINE_HM ||
+       form->mode == HEX8_HM || form->mode == DECIMAL8_HM))
+    pool = saltinit(form->threads, keys, nkeys, *smax, scramble, form);
+#endif
+
   /* Actually find the perfect hash */
   *salt = 0;
   bad_initkey = 0;
@@ -877,6 +1235,14 @@ hashform *form;                                           /* user directives */
     ub4 rslinit;
     /* Try to find distinct (A,B) for all keys */
     
+#ifdef THREADS
+    if (pool)
+    {
+      tried = saltget(pool, trysalt, *alen, *blen);
+      rslinit = (tried->result == 0) ? 0 : 1;
+    }
+    else
+#endif
     rslinit = initkey(keys, nkeys, *tabb, *alen, *blen, *smax, trysalt,
 		      form, final);
 
@@ -906,7 +1272,6 @@ hashform *form;                                           /* user directives */
 	}
 	else
 	{
-	  duplicates(*tabb, *blen, keys, form);      /* check for duplicates */
 	  printf("fatal error: Cannot perfect hash: cannot find distinct (A,B)\n");
 	  exit(SUCCESS);
 	}
@@ -918,9 +1283,32 @@ hashform *form;                                           /* user directives */
 
     printf("found distinct (A,B) on attempt %ld\n", trysalt);
 
+#ifdef THREADS
+    if (pool)
+    {
+      if (tried->result == 2)
+      {                      /* redo the winner on our own keys and tables */
+	(void)initkey(keys, nkeys, *tabb, *alen, *blen, *smax, trysalt,
+		      form, final);
+	(void)perfect(*tabb, tabh, tabq, *blen, *smax, scramble, nkeys, form,
+		      &failsize);
+	*salt = trysalt;
+	break;
+      }
+      failsize = tried->failsize;
+    }
+#endif
+
     /* Given distinct (A,B) for all keys, build a perfect hash */
-    if (!perfect(*tabb, tabh, tabq, *blen, *smax, scramble, nkeys, form))
+    if (
+#ifdef THREADS
+        pool ||
+#endif
+	!perfect(*tabb, tabh, tabq, *blen, *smax, scramble, nkeys, form,
+		 &failsize))
     {
+      printf("fail to map group of size %ld for tab size %ld\n", 
+	     failsize, *blen);
       if ((form->hashtype != INT_HT && ++bad_perfect >= RETRY_PERFECT) || 
 	  (form->hashtype == INT_HT && ++bad_perfect >= RETRY_HEX))
       {
@@ -950,67 +1338,550 @@ hashform *form;                                           /* user directives */
   printf("built perfect hash table of size %ld\n", *blen);
 
   /* free working memory */
+#ifdef THREADS
+  if (pool) saltfree(pool);
+#endif
   free((void *)tabh);
   free((void *)tabq);
 }
 
+
+/* take the keys of b out of tabh */
+static void unmapb(tabh, scramble, b)
+hstuff *tabh;
+ub4    *scramble;
+bstuff *b;
+{
+  ub4  stabb = scramble[b->val_b];
+  key *mykey;
+  for (mykey=b->list_b; mykey; mykey=mykey->nextb_k)
+    if (tabh[mykey->a_k^stabb].key_h == mykey)
+      tabh[mykey->a_k^stabb].key_h = (key *)0;
+}
+
+/*
+ * Map b by force, when augment() can't: choose the tab[b] that collides
+ * with the fewest keys, counting only b's with fewer keys than b, then
+ * unmap the b's it collides with and add them to redo[].  Those are
+ * smaller, so they are easier for augment() to place again.
+ * Returns FALSE if no value of tab[b] will do.
+ */
+static int evict(tabb, tabh, blen, smax, scramble, item, nkeys, form,
+		 highwater, redo, nredo)
+bstuff   *tabb;
+hstuff   *tabh;
+ub4       blen;
+ub4       smax;
+ub4      *scramble;
+bstuff   *item;                                      /* the b to be mapped */
+ub4       nkeys;
+hashform *form;
+ub4      *highwater;         /* input/output, higher than any water_b yet */
+ub4      *redo;                                 /* b's that are not mapped */
+ub4      *nredo;                                    /* input/output, #redo */
+{
+  ub4  limit = ((blen < USE_SCRAMBLE) ? smax : UB1MAXVAL+1);
+  ub4  highhash = ((form->perfect == MINIMAL_HP) ? nkeys : smax);
+  ub4  best = 0, bestcost = UB4MAXVAL;
+  ub4  i, stabb;
+  key *mykey;
+
+  for (i=0; i<limit; ++i)
+  {
+    ub4 cost = 0;
+    ++*highwater;
+    for (mykey=item->list_b; mykey; mykey=mykey->nextb_k)
+    {
+      ub4 hash = mykey->a_k^scramble[i];
+      if (hash >= highhash) break;
+      if (tabh[hash].key_h)
+      {
+	bstuff *hitb = &tabb[tabh[hash].key_h->b_k];
+	if (hitb->listlen_b >= item->listlen_b) break;
+	if (hitb->water_b != *highwater)
+	{
+	  hitb->water_b = *highwater;
+	  cost += hitb->listlen_b;
+	}
+      }
+    }
+    if (!mykey && cost < bestcost)
+    {
+      best = i;
+      bestcost = cost;
+    }
+  }
+  if (bestcost == UB4MAXVAL)
+    return FALSE;
+
+  stabb = scramble[best];
+  for (mykey=item->list_b; mykey; mykey=mykey->nextb_k)
+  {
+    ub4 hash = mykey->a_k^stabb;
+    if (tabh[hash].key_h)
+    {
+      bstuff *hitb = &tabb[tabh[hash].key_h->b_k];
+      unmapb(tabh, scramble, hitb);
+      redo[(*nredo)++] = (ub4)(hitb - tabb);
+    }
+  }
+  item->val_b = best;
+  for (mykey=item->list_b; mykey; mykey=mykey->nextb_k)
+    tabh[mykey->a_k^stabb].key_h = mykey;
+  return TRUE;
+}
+
+/*
+ * Remap a new set of keys with an old tab[].  (a,b) for every key is
+ * recomputed with the old salt, then every b whose keys all still land on
+ * distinct hashes in range keeps its old tab[b].  The other b's are mapped
+ * biggest first, by augment() as in perfect(), or by evicting smaller b's
+ * when the table is too full for that.  When only a few keys changed, few
+ * b's are disturbed and this is far faster than a rebuild.
+ */
+static int repair(tabb, tabh, tabq, blen, smax, scramble, nkeys, form,
+		  failsize, nmoved)
+bstuff   *tabb;                  /* keys by b, val_b is the old tab[] value */
+hstuff   *tabh;
+qstuff   *tabq;
+ub4       blen;
+ub4       smax;
+ub4      *scramble;
+ub4       nkeys;
+hashform *form;
+ub4      *failsize;         /* output, size of the group that failed to map */
+ub4      *nmoved;                  /* output, number of b's mapped again */
+{
+  ub4  highhash = ((form->perfect == MINIMAL_HP) ? nkeys : smax);
+  ub4 *redo;                                /* the b's that must be remapped */
+  ub4  nredo = 0;
+  ub4  highwater = 0;         /* inittab set all water_b to 0, go above that */
+  ub4  budget;                           /* evictions allowed before giving up */
+  ub4  i;
+
+  memset((void *)tabh, 0, (size_t)(sizeof(hstuff)*highhash));
+  memset((void *)tabq, 0, (size_t)(sizeof(qstuff)*(blen+1)));
+  redo = (ub4 *)remalloc(sizeof(ub4)*blen, "perfect.c, redo");
+
+  /* keep each b whose keys all fit where the old tab[b] puts them */
+  for (i=0; i<blen; ++i)
+  {
+    ub4  stabb = scramble[tabb[i].val_b];
+    key *mykey;
+    key *k;
+
+    for (mykey=tabb[i].list_b; mykey; mykey=mykey->nextb_k)
+    {
+      ub4 hash = mykey->a_k^stabb;
+      if (hash >= highhash || tabh[hash].key_h) break;
+      tabh[hash].key_h = mykey;
+    }
+    if (!mykey) continue;
+    for (k=tabb[i].list_b; k != mykey; k=k->nextb_k)  /* undo partial b */
+      tabh[k->a_k^stabb].key_h = (key *)0;
+    redo[nredo++] = i;
+  }
+
+  /* map the b's that didn't fit, always the biggest one left first */
+  *nmoved = 0;
+  budget = REPAIR_EVICT + 4*nredo;
+  while (nredo > 0)
+  {
+    ub4     big = 0;
+    bstuff *item;
+
+    for (i=1; i<nredo; ++i)
+      if (tabb[redo[i]].listlen_b > tabb[redo[big]].listlen_b)
+	big = i;
+    item = &tabb[redo[big]];
+    redo[big] = redo[--nredo];
+    ++*nmoved;
+    if (item->listlen_b == 0 ||
+	augment(tabb, tabh, tabq, blen, scramble, smax, item, nkeys, 
+		++highwater, form))
+      continue;
+    if (budget == 0 ||
+	!evict(tabb, tabh, blen, smax, scramble, item, nkeys, form,
+	       &highwater, redo, &nredo))
+    {
+      *failsize = item->listlen_b;
+      free((void *)redo);
+      return FALSE;
+    }
+    --budget;
+  }
+
+  free((void *)redo);
+  return TRUE;
+}
+
+/*
+** findhash_incr: like findhash, but start from an existing perfect hash.
+** *tabb, *alen, *blen, *salt and *smax describe the old hash (only
+** (*tabb)[].val_b is used from *tabb, which must come from malloc), and
+** keys is the complete new set of keys.  The old salt and tab[] values
+** are kept and only the b's that the changed keys disturb are remapped.
+** If that fails, or the old hash can't be reused (integer or (A,B) keys,
+** or too many keys for smax), this does a full findhash instead.
+** Returns TRUE if the old hash was reused.
+*/
+word findhash_incr(tabb, alen, blen, salt, final, 
+		   scramble, smax, keys, nkeys, form)
+bstuff  **tabb;            /* input: old tab[]; output: tab[] of new hash */
+ub4      *alen;              /* input/output, a of (a,b) is in 0..alen-1 */
+ub4      *blen;              /* input/output, b of (a,b) is in 0..blen-1 */
+ub4      *salt;                  /* input/output, initializes initial hash */
+gencode  *final;                                      /* code for final hash */
+ub4      *scramble;              /* output, hash = a^scramble[tab[b]] */
+ub4      *smax;                  /* input/output, scramble[i] in 0..smax-1 */
+key      *keys;                                   /* input, new keys to hash */
+ub4       nkeys;                   /* input, number of new keys being hashed */
+hashform *form;                                           /* user directives */
+{
+  hstuff *tabh;
+  qstuff *tabq;
+  ub2    *oldval;
+  ub4     i, failsize, nmoved;
+  int     ok;
+
+  if ((form->mode != NORMAL_HM && form->mode != INLINE_HM &&
+       form->mode != HEX8_HM && form->mode != DECIMAL8_HM) ||
+      *blen == 0 || *salt == 0 || nkeys <= 1 || nkeys > *smax)
+  {
+    free((void *)*tabb);
+    findhash(tabb, alen, blen, salt, final, 
+	     scramble, smax, keys, nkeys, form);
+    return FALSE;
+  }
+
+  /* recompute (a,b) with the old salt; inittab clears val_b, so save it */
+  scrambleinit(scramble, *smax);
+  oldval = (ub2 *)remalloc(sizeof(ub2)*(*blen), "perfect.c, oldval");
+  for (i=0; i<*blen; ++i)
+    oldval[i] = (*tabb)[i].val_b;
+  ok = (initkey(keys, nkeys, *tabb, *alen, *blen, *smax, *salt,
+		form, final) == 1);
+  for (i=0; i<*blen; ++i)
+    (*tabb)[i].val_b = oldval[i];
+  free((void *)oldval);
+
+  if (ok)
+  {
+    tabq = (qstuff *)remalloc(sizeof(qstuff)*(*blen+1), "perfect.c, tabq");
+    tabh = (hstuff *)remalloc(sizeof(hstuff)*(form->perfect == MINIMAL_HP ? 
+					       nkeys : *smax),
+			       "perfect.c, tabh");
+    ok = repair(*tabb, tabh, tabq, *blen, *smax, scramble, nkeys, form,
+		&failsize, &nmoved);
+    free((void *)tabh);
+    free((void *)tabq);
+    if (ok)
+    {
+      printf("remapped %ld of %ld tab entries for the new keys\n",
+	     nmoved, *blen);
+      return TRUE;
+    }
+    printf("fail to remap group of size %ld, rebuilding\n", failsize);
+  }
+  else
+    printf("new keys have no distinct (A,B) with the old salt, rebuilding\n");
+
+  free((void *)*tabb);
+  findhash(tabb, alen, blen, salt, final, 
+	   scramble, smax, keys, nkeys, form);
+  return FALSE;
+}
+
 /*
 ------------------------------------------------------------------------------
-Input/output type routines
+keymap: a table of every key's fingerprint and value, indexed by its hash,
+so phash_find() can reject keys not in the set and return the value of
+keys that are, with one lookup in phashmap[].  For integer keys the
+fingerprint is the key itself, so that is exact; for strings it is a
+second 32-bit hash of the key, so a string not in the set gets through
+with probability 2^-32.  Empty entries hold PHASHNONE as their value.
+These are also used by make_bdz, so they are not PERFECT_LIBRARY-only.
 ------------------------------------------------------------------------------
 */
 
-/* get the list of keys */
-static void getkeys(keys, nkeys, textroot, keyroot, form)
-key      **keys;                                         /* list of all keys */
-ub4       *nkeys;                                          /* number of keys */
-reroot    *textroot;                          /* get space to store key text */
-reroot    *keyroot;                                    /* get space for keys */
-hashform  *form;                                          /* user directives */
+/* declarations for phashmap[] in phash.h */
+void make_map_h(f, maplen, form)
+FILE     *f;                                        /* phash.h, being written */
+ub4       maplen;       /* entries in phashmap[], hashes of keys are below it */
+hashform *form;                                           /* user directives */
 {
+  word wide = (form->hashtype == INT8_HT);
+
+  fprintf(f, "/* phashmap[phash(key)] holds the key's fingerprint and value */\n");
+  fprintf(f, "struct phashent\n");
+  fprintf(f, "{\n");
+  if (form->hashtype == STRING_HT)
+    fprintf(f, "  ub4 fp;            /* lookup(key, len, PHASHFP) */\n");
+  else
+    fprintf(f, "  %s fp;                                  /* the key */\n",
+	    wide ? "ub8" : "ub4");
+  fprintf(f, "  ub4 val;                 /* value given with the key */\n");
+  fprintf(f, "};\n");
+  fprintf(f, "typedef  struct phashent  phashent;\n");
+  fprintf(f, "extern phashent phashmap[];\n");
+  fprintf(f, "#define PHASHMAPLEN %ld  /* entries in phashmap[] */\n", maplen);
+  if (form->hashtype == STRING_HT)
+    fprintf(f, "#define PHASHFP 0x%.8lx  /* seed for key fingerprints */\n",
+	    (ub4)PHASHFP);
+  fprintf(f, "#define PHASHNONE 0x%lx  /* value of keys not in the set */\n",
+	  (ub4)PHASHNONE);
+  fprintf(f, "ub4 phash_find();\n");
+  fprintf(f, "\n");
+}
+
+/* phashmap[] and phash_find() in phash.c */
+void make_map_c(f, keys, rsl, maplen, form)
+FILE     *f;                                        /* phash.c, being written */
+key      *keys;                                          /* list of all keys */
+ub4      *rsl;                   /* rsl[i] is the hash of the ith key in keys */
+ub4       maplen;                                 /* entries in phashmap[] */
+hashform *form;                                           /* user directives */
+{
+  ub8  *fp  = (ub8 *)remalloc(sizeof(ub8)*(maplen+1), "perfect.c, fp");
+  ub4  *val = (ub4 *)remalloc(sizeof(ub4)*(maplen+1), "perfect.c, val");
   key  *mykey;
-  char *mytext;
-  mytext = (char *)renew(textroot);
-  *keys = 0;
-  *nkeys = 0;
-  while (fgets(mytext, MAXKEYLEN, stdin))
+  word  wide = (form->hashtype == INT8_HT);
+  ub4   i;
+
+  for (i=0; i<maplen; ++i)
+  {
+    fp[i] = 0;
+    val[i] = PHASHNONE;
+  }
+  for (i=0, mykey=keys; mykey; ++i, mykey=mykey->next_k)
   {
-    mykey = (key *)renew(keyroot);
-    if (form->mode == AB_HM)
+    switch (form->hashtype)
     {
-      sscanf(mytext, "%lx %lx ", &mykey->a_k, &mykey->b_k);
+    case STRING_HT: 
+      fp[rsl[i]] = lookup(mykey->name_k, mykey->len_k, PHASHFP); break;
+    case INT8_HT:
+      fp[rsl[i]] = mykey->hash8_k; break;
+    default:
+      fp[rsl[i]] = mykey->hash_k; break;
     }
-    else if (form->mode == ABDEC_HM)
+    val[rsl[i]] = mykey->val_k;
+  }
+
+  fprintf(f, "/* fingerprints and values of the keys, indexed by phash() */\n");
+  fprintf(f, "phashent phashmap[] = {\n");
+  for (i=0; i<maplen; ++i)
+  {
+    if (wide)
+      fprintf(f, "{0x%.16llxLL,0x%lx},%s", fp[i], val[i], 
+	      (i%4 == 3) ? "\n" : "");
+    else
+      fprintf(f, "{0x%.8lx,0x%lx},%s", (ub4)fp[i], val[i], 
+	      (i%4 == 3) ? "\n" : "");
+  }
+  fprintf(f, "};\n");
+  fprintf(f, "\n");
+
+  fprintf(f, "/* The value given with a key, or PHASHNONE if it is not a key */\n");
+  switch (form->hashtype)
+  {
+  case STRING_HT:
+    fprintf(f, "ub4 phash_find(key, len)\n");
+    fprintf(f, "char *key;\n");
+    fprintf(f, "int   len;\n");
+    fprintf(f, "{\n");
+    if (form->mode == INLINE_HM)
     {
-      sscanf(mytext, "%ld %ld ", &mykey->a_k, &mykey->b_k);
+      fprintf(f, "  ub4 i, h = PHASHSALT;\n");
+      fprintf(f, "  phashent *e;\n");
+      fprintf(f, "  for (i=0; i<(ub4)len; ++i)\n");
+      fprintf(f, "    h = (((ub1 *)key)[i] ^ h) + ((h<<26)+(h>>6));\n");
+      fprintf(f, "  h = phash(h);\n");
     }
-    else if (form->mode == HEX_HM)
+    else
     {
-      sscanf(mytext, "%lx ", &mykey->hash_k);
+      fprintf(f, "  ub4 h = phash(key, len);\n");
+      fprintf(f, "  phashent *e;\n");
     }
-    else if (form->mode == DECIMAL_HM)
+    fprintf(f, "  if (h >= PHASHMAPLEN) return PHASHNONE;\n");
+    fprintf(f, "  e = &phashmap[h];\n");
+    fprintf(f, "  if (e->fp != lookup((ub1 *)key, (ub4)len, PHASHFP)) return PHASHNONE;\n");
+    break;
+  default:
+    fprintf(f, "ub4 phash_find(val)\n");
+    fprintf(f, "%s val;\n", wide ? "ub8" : "ub4");
+    fprintf(f, "{\n");
+    fprintf(f, "  ub4 h = phash(val);\n");
+    fprintf(f, "  phashent *e;\n");
+    fprintf(f, "  if (h >= PHASHMAPLEN) return PHASHNONE;\n");
+    fprintf(f, "  e = &phashmap[h];\n");
+    fprintf(f, "  if (e->fp != val) return PHASHNONE;\n");
+    break;
+  }
+  fprintf(f, "  return e->val;\n");
+  fprintf(f, "}\n");
+  fprintf(f, "\n");
+
+  free((void *)fp);
+  free((void *)val);
+}
+
+#ifndef PERFECT_LIBRARY   /* perflib.c supplies its own input and output */
+
+/*
+------------------------------------------------------------------------------
+Input/output type routines
+------------------------------------------------------------------------------
+*/
+
+/* all the key text: stdin, either mapped or read into one buffer */
+struct keytext
+{
+  char   *text;                                       /* the whole input */
+  size_t  len;                                        /* length of text */
+  int     mapped;                      /* TRUE if text is mmapped stdin */
+  key    *keyv;                            /* one key for each line */
+};
+typedef  struct keytext  keytext;
+
+/* map stdin if it is a file, else read it all */
+static void readkeys(kt)
+keytext *kt;
+{
+  struct stat st;
+  size_t      room;
+  ssize_t     got;
+
+  kt->mapped = FALSE;
+  if (fstat(0, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
+  {
+    kt->len = (size_t)st.st_size;
+    kt->text = (char *)mmap((void *)0, kt->len, PROT_READ, MAP_PRIVATE, 0, 0);
+    if (kt->text != (char *)MAP_FAILED)
     {
-      sscanf(mytext, "%ld ", &mykey->hash_k);
+      kt->mapped = TRUE;
+      return;
+    }
+  }
+
+  room = 1<<16;
+  kt->len = 0;
+  kt->text = (char *)remalloc(room, "perfect.c, key text");
+  while ((got = read(0, kt->text+kt->len, room-kt->len)) > 0)
+  {
+    kt->len += (size_t)got;
+    if (kt->len == room)
+    {
+      room *= 2;
+      if (!(kt->text = (char *)realloc(kt->text, room)))
+      {
+	fprintf(stderr, "realloc of %lu failed for perfect.c, key text\n",
+		(unsigned long)room);
+	exit(SUCCESS);
+      }
+    }
+  }
+}
+
+/* get the list of keys, one per line of stdin, of any length */
+static void getkeys(keys, nkeys, kt, form)
+key      **keys;                                         /* list of all keys */
+ub4       *nkeys;                                          /* number of keys */
+keytext   *kt;                                 /* output, the text of keys */
+hashform  *form;                                          /* user directives */
+{
+  key   *mykey;
+  char  *line, *end, *eol;
+  char   num[80];                      /* a line for sscanf, NUL terminated */
+  size_t i, len;
+
+  readkeys(kt);
+  end = kt->text + kt->len;
+
+  /* count lines, so all the keys are one allocation */
+  for (*nkeys=0, line=kt->text; line<end; ++*nkeys)
+  {
+    eol = (char *)memchr(line, '\n', (size_t)(end-line));
+    line = eol ? eol+1 : end;
+  }
+  kt->keyv = (key *)remalloc(sizeof(key)*(*nkeys+1), "perfect.c, keys");
+
+  /* keys are views of the text; the list is in reverse, as it always was */
+  *keys = (key *)0;
+  for (i=0, line=kt->text; line<end; ++i, line=eol+1)
+  {
+    if (!(eol = (char *)memchr(line, '\n', (size_t)(end-line)))) eol = end;
+    len = (size_t)(eol-line);
+    mykey = &kt->keyv[i];
+    mykey->val_k = (ub4)i;                  /* by default, the line number */
+    if (form->keymap)
+    {                              /* "key<tab>value" gives the key a value */
+      char         *tab;
+      unsigned long value;
+      for (tab=eol; tab>line && tab[-1] != '\t'; --tab) ;
+      if (tab-- > line)
+      {
+	size_t vlen = (size_t)(eol-tab-1);
+	if (vlen >= sizeof(num)) vlen = sizeof(num)-1;
+	memcpy(num, tab+1, vlen);
+	num[vlen] = '\0';
+	value = strtoul(num, (char **)0, 0);
+	if (value >= PHASHNONE)              /* PHASHNONE means "not a key" */
+	{
+	  fprintf(stderr,
+		  "fatal error: line %lu: value %s is not below 0x%lx\n",
+		  (unsigned long)i+1, num, (unsigned long)PHASHNONE);
+	  exit(1);
+	}
+	mykey->val_k = (ub4)(value & 0xffffffff);
+	len = (size_t)(tab-line);
+      }
+    }
+    if (form->mode == NORMAL_HM || form->mode == INLINE_HM)
+    {
+      mykey->name_k = (ub1 *)line;
+      mykey->len_k  = (ub4)len;
     }
     else
     {
-      mykey->name_k = (ub1 *)mytext;
-      mytext = (char *)renew(textroot);
-      mykey->len_k  = (ub4)(strlen((char *)mykey->name_k)-1);
+      if (len >= sizeof(num)) len = sizeof(num)-1;
+      memcpy(num, line, len);
+      num[len] = '\0';
+      if (form->mode == AB_HM)
+	sscanf(num, "%lx %lx ", &mykey->a_k, &mykey->b_k);
+      else if (form->mode == ABDEC_HM)
+	sscanf(num, "%ld %ld ", &mykey->a_k, &mykey->b_k);
+      else if (form->mode == HEX_HM)
+	sscanf(num, "%lx ", &mykey->hash_k);
+      else if (form->mode == DECIMAL_HM)
+	sscanf(num, "%ld ", &mykey->hash_k);
+      else if (form->mode == HEX8_HM)
+	sscanf(num, "%llx ", &mykey->hash8_k);
+      else if (form->mode == DECIMAL8_HM)
+	sscanf(num, "%llu ", &mykey->hash8_k);
     }
     mykey->next_k = *keys;
     *keys = mykey;
-    ++*nkeys;
   }
-  redel(textroot, mytext);
+}
+
+/* give back what getkeys got */
+static void freekeys(kt)
+keytext *kt;
+{
+  if (kt->mapped)
+    munmap((void *)kt->text, kt->len);
+  else
+    free((void *)kt->text);
+  free((void *)kt->keyv);
 }
 
 /* make the .h file */
-static void make_h(blen, smax, nkeys, salt)
-ub4  blen;
-ub4  smax;
-ub4  nkeys;
-ub4  salt;
+static void make_h(blen, smax, nkeys, salt, form)
+ub4       blen;
+ub4       smax;
+ub4       nkeys;
+ub4       salt;
+hashform *form;
 {
   FILE *f;
   f = fopen("phash.h", "w");
@@ -1047,25 +1918,151 @@ ub4  salt;
           salt*0x9e3779b9);
   fprintf(f, "\n");
   fprintf(f, "ub4 phash();\n");
+  if (form->batch)
+  {
+    fprintf(f, "#define PHASHBATCH  /* phash_batch(inputs, out, n) exists */\n");
+    fprintf(f, "void phash_batch();\n");
+  }
   fprintf(f, "\n");
+  if (form->keymap)
+    make_map_h(f, (form->perfect == MINIMAL_HP) ? nkeys : smax, form);
   fprintf(f, "#endif  /* PHASH */\n");
   fprintf(f, "\n");
   fclose(f);
 }
 
+/*
+ * Write phash_batch(), which does out[i] = phash(inputs[i]) for i<n.
+ * Its scalar loop is just phash() again.  Compiled with AVX2 (gcc or
+ * clang -mavx2), keys go 8 at a time.  For H and D, phash()'s own mix
+ * lines run on a phashv, 8 lanes of ub4, so they vectorize and still
+ * wrap exactly as phash() does, whether ub4 is 4 bytes or the 8 bytes
+ * of an LP64 unsigned long.  X and Y need a 64-bit multiply, so they
+ * mix a key at a time.  Then tab[b] and scramble[tab[b]] are gathers
+ * in 32-bit lanes: av[], bv[] and ov[] are unsigned int, and out[] is
+ * filled from ov[].  make_c pads tab[] and scramble[] so that a 4-byte
+ * gather of their last element stays in the array.
+ */
+#define BINDENT(line) ((line)[0] == '\n' ? "" : "  ")   /* indent a line */
+static void make_batch(f, smax, blen, final, form)
+FILE     *f;                                        /* phash.c, being written */
+ub4       smax;                                       /* range of scramble[] */
+ub4       blen;                                /* b in 0..blen-1, power of 2 */
+gencode  *final;                                  /* code for the final hash */
+hashform *form;                                           /* user directives */
+{
+  ub4   i;
+  ub4   tabw = (smax <= UB1MAXVAL+1 || blen >= USE_SCRAMBLE) ? 1 : 2;
+  ub4   scrw = (smax > UB2MAXVAL+1) ? 4 : 2;
+  word  wide = (form->mode == HEX8_HM || form->mode == DECIMAL8_HM);
+
+  if (blen > 0 && !wide)
+  {
+    fprintf(f, "#if defined(__AVX2__) && defined(__GNUC__)\n");
+    fprintf(f, "/* 8 keys at once, in lanes as wide as ub4 so they wrap like phash */\n");
+    fprintf(f, "typedef ub4 phashv __attribute__((vector_size(8*sizeof(ub4))));\n");
+    fprintf(f, "#endif\n");
+    fprintf(f, "\n");
+  }
+  fprintf(f, "/* Hash n keys at once: out[i] = phash(inputs[i]) */\n");
+  fprintf(f, "void phash_batch(inputs, out, n)\n");
+  fprintf(f, "const %s *inputs;\n", wide ? "ub8" : "ub4");
+  fprintf(f, "ub4       *out;\n");
+  fprintf(f, "size_t     n;\n");
+  fprintf(f, "{\n");
+  fprintf(f, "  size_t i = 0;\n");
+  if (blen > 0)
+  {
+    /* a and b are known to come from hexn() or inithex8() here */
+    fprintf(f, "#if defined(__AVX2__) && defined(__GNUC__)\n");
+    fprintf(f, "  for (; i+8 <= n; i += 8)\n");
+    fprintf(f, "  {\n");
+    if (!wide)
+      fprintf(f, "    phashv       val, a, b;\n");
+    fprintf(f, "    unsigned int av[8], bv[8], ov[8];\n");
+    fprintf(f, "    __m256i      va, vb, rsl;\n");
+    fprintf(f, "    int          j;\n");
+    if (wide)
+    {                              /* X, Y: the mix multiplies in 64 bits */
+      fprintf(f, "    for (j=0; j<8; ++j)\n");
+      fprintf(f, "    {\n");
+      fprintf(f, "      ub8 val = inputs[i+j];\n");
+      for (i=0; i+1<final->used; ++i)            /* all but the rsl line */
+	fprintf(f, "%s%s%s", BINDENT(final->line[i]),
+		BINDENT(final->line[i]), final->line[i]);
+      fprintf(f, "      av[j] = (unsigned int)a;\n");
+      fprintf(f, "      bv[j] = (unsigned int)b;\n");
+      fprintf(f, "    }\n");
+    }
+    else
+    {                 /* H, D: hexn's shifts, adds, xors and masks, 8 wide */
+      fprintf(f, "    for (j=0; j<8; ++j)\n");
+      fprintf(f, "      val[j] = inputs[i+j];\n");
+      for (i=1; i+1<final->used; ++i)      /* not the declaration or rsl */
+	if (final->line[i][0] != '\n')
+	  fprintf(f, "  %s", final->line[i]);
+      fprintf(f, "    for (j=0; j<8; ++j)\n");
+      fprintf(f, "    {\n");
+      fprintf(f, "      av[j] = (unsigned int)a[j];\n");
+      fprintf(f, "      bv[j] = (unsigned int)b[j];\n");
+      fprintf(f, "    }\n");
+    }
+    fprintf(f, "    va = _mm256_loadu_si256((const __m256i *)av);\n");
+    fprintf(f, "    vb = _mm256_loadu_si256((const __m256i *)bv);\n");
+    fprintf(f, 
+	    "    rsl = _mm256_i32gather_epi32((const int *)tab, vb, %ld);\n",
+	    tabw);
+    fprintf(f, "    rsl = _mm256_and_si256(rsl, _mm256_set1_epi32(0x%lx));\n",
+	    (unsigned long)((tabw == 1) ? UB1MAXVAL : UB2MAXVAL));
+    if (blen >= USE_SCRAMBLE)
+    {
+      /* a 4-byte scramble[] is ub4, so its stride is sizeof(ub4) */
+      fprintf(f, 
+	      "    rsl = _mm256_i32gather_epi32((const int *)scramble, rsl, %s);\n",
+	      (scrw < 4) ? "2" : "sizeof(ub4)");
+      if (scrw < 4)
+	fprintf(f, "    rsl = _mm256_and_si256(rsl, _mm256_set1_epi32(0x%lx));\n",
+		(unsigned long)UB2MAXVAL);
+    }
+    fprintf(f, "    rsl = _mm256_xor_si256(va, rsl);\n");
+    fprintf(f, "    _mm256_storeu_si256((__m256i *)ov, rsl);\n");
+    fprintf(f, "    for (j=0; j<8; ++j)\n");
+    fprintf(f, "      out[i+j] = ov[j];\n");
+    fprintf(f, "  }\n");
+    fprintf(f, "#endif\n");
+  }
+  fprintf(f, "  for (; i<n; ++i)\n");
+  fprintf(f, "  {\n");
+  fprintf(f, "    %s val = inputs[i];\n", wide ? "ub8" : "ub4");
+  for (i=0; i<final->used; ++i)
+    fprintf(f, "%s%s", BINDENT(final->line[i]), final->line[i]);
+  fprintf(f, "    out[i] = rsl;\n");
+  fprintf(f, "  }\n");
+  fprintf(f, "}\n");
+  fprintf(f, "\n");
+}
+
 /* make the .c file */
-static void make_c(tab, smax, blen, scramble, final, form)
+static void make_c(tab, smax, blen, scramble, final, keys, nkeys, form)
 bstuff   *tab;                                         /* table indexed by b */
 ub4       smax;                                       /* range of scramble[] */
 ub4       blen;                                /* b in 0..blen-1, power of 2 */
 ub4      *scramble;                                    /* used in final hash */
 gencode  *final;                                  /* code for the final hash */
+key      *keys;                                          /* list of all keys */
+ub4       nkeys;                                   /* number of keys hashed */
 hashform *form;                                           /* user directives */
 {
   ub4   i;
   FILE *f;
   f = fopen("phash.c", "w");
   fprintf(f, "/* table for the mapping for the perfect hash */\n");
+  if (form->batch && blen > 0)
+  {
+    fprintf(f, "#if defined(__AVX2__) && defined(__GNUC__)\n");
+    fprintf(f, "#include <immintrin.h>\n");
+    fprintf(f, "#endif\n");
+  }
   fprintf(f, "#ifndef STANDARD\n");
   fprintf(f, "#include \"standard.h\"\n");
   fprintf(f, "#endif /* STANDARD */\n");
@@ -1094,6 +2091,8 @@ hashform *form;                                           /* user directives */
 "0x%.4lx, 0x%.4lx, 0x%.4lx, 0x%.4lx, 0x%.4lx, 0x%.4lx, 0x%.4lx, 0x%.4lx,\n",
                 scramble[i+0], scramble[i+1], scramble[i+2], scramble[i+3],
                 scramble[i+4], scramble[i+5], scramble[i+6], scramble[i+7]);
+      if (form->batch)
+	fprintf(f, "0x0000,  /* so phash_batch can gather 4 bytes */\n");
     }
     fprintf(f, "};\n");
     fprintf(f, "\n");
@@ -1146,6 +2145,13 @@ hashform *form;                                           /* user directives */
 		tab[i+12].val_b, tab[i+13].val_b, 
 		tab[i+14].val_b, tab[i+15].val_b); 
     }
+    if (form->batch)
+    {
+      if (smax <= UB1MAXVAL+1 || blen >= USE_SCRAMBLE)
+	fprintf(f, "0,0,0,  /* so phash_batch can gather 4 bytes */\n");
+      else
+	fprintf(f, "0,  /* so phash_batch can gather 4 bytes */\n");
+    }
     fprintf(f, "};\n");
     fprintf(f, "\n");
   }
@@ -1163,6 +2169,11 @@ hashform *form;                                           /* user directives */
     fprintf(f, "ub4 phash(val)\n");
     fprintf(f, "ub4 val;\n");
     break;
+  case HEX8_HM:
+  case DECIMAL8_HM:
+    fprintf(f, "ub4 phash(val)\n");
+    fprintf(f, "ub8 val;\n");
+    break;
   case AB_HM:
   case ABDEC_HM:
     fprintf(f, "ub4 phash(a,b)\n");
@@ -1176,6 +2187,19 @@ hashform *form;                                           /* user directives */
   fprintf(f, "  return rsl;\n");
   fprintf(f, "}\n");
   fprintf(f, "\n");
+  if (form->batch)
+    make_batch(f, smax, blen, final, form);
+  if (form->keymap)
+  {
+    ub4 *rsl = (ub4 *)remalloc(sizeof(ub4)*(nkeys+1), "perfect.c, rsl");
+    key *mykey;
+    for (i=0, mykey=keys; mykey; ++i, mykey=mykey->next_k)
+      rsl[i] = (blen > 0) ? (mykey->a_k^scramble[tab[mykey->b_k].val_b]) :
+	(nkeys > 1) ? mykey->a_k : 0;          /* hextwo left the hash in a_k */
+    make_map_c(f, keys, rsl, (form->perfect == MINIMAL_HP) ? nkeys : smax,
+	       form);
+    free((void *)rsl);
+  }
   fclose(f);
 }
 
@@ -1194,18 +2218,13 @@ hashform *form;                                           /* user directives */
   ub4       alen;                            /* a in 0..alen-1, a power of 2 */
   ub4       blen;                            /* b in 0..blen-1, a power of 2 */
   ub4       salt;                       /* a parameter to the hash function */
-  reroot   *textroot;                      /* MAXKEYLEN-character text lines */
-  reroot   *keyroot;                                       /* source of keys */
+  keytext   kt;                              /* where the keys came from */
   gencode   final;                                    /* code for final hash */
   ub4       i;
   ub4       scramble[SCRAMBLE_LEN];           /* used in final hash function */
   char      buf[10][80];                        /* buffer for generated code */
   char     *buf2[10];                             /* also for generated code */
 
-  /* set up memory sources */
-  textroot = remkroot((size_t)MAXKEYLEN);
-  keyroot  = remkroot(sizeof(key));
-
   /* set up code for final hash */
   final.line = buf2;
   final.used = 0;
@@ -1213,24 +2232,35 @@ hashform *form;                                           /* user directives */
   for (i=0; i<10; ++i) final.line[i] = buf[i];
 
   /* read in the list of keywords */
-  getkeys(&keys, &nkeys, textroot, keyroot, form);
+  getkeys(&keys, &nkeys, &kt, form);
   printf("Read in %ld keys\n",nkeys);
 
+  if (form->construct == BDZ_HC)
+  {
+    bdz b;
+    findbdz(&b, keys, nkeys, form);
+    make_bdz(&b, keys, nkeys, form);
+    free((void *)b.g);
+    if (b.rank) free((void *)b.rank);
+    freekeys(&kt);
+    printf("Cleaned up\n");
+    return;
+  }
+
   /* find the hash */
   findhash(&tab, &alen, &blen, &salt, &final, 
 	   scramble, &smax, keys, nkeys, form);
 
   /* generate the phash.h file */
-  make_h(blen, smax, nkeys, salt);
+  make_h(blen, smax, nkeys, salt, form);
   printf("Wrote phash.h\n");
 
   /* generate the phash.c file */
-  make_c(tab, smax, blen, scramble, &final, form);
+  make_c(tab, smax, blen, scramble, &final, keys, nkeys, form);
   printf("Wrote phash.c\n");
 
   /* clean up memory sources */
-  refree(textroot);
-  refree(keyroot);
+  freekeys(&kt);
   free((void *)tab);
   printf("Cleaned up\n");
 }
@@ -1239,9 +2269,9 @@ hashform *form;                                           /* user directives */
 /* Describe how to use this utility */
 static void usage_error()
 {
-  printf("Usage: perfect [-{NnIiHhDdAaBb}{MmPp}{FfSs}] < key.txt \n");
+  printf("Usage: perfect [-{NnIiHhDdXxYyAaBb}{MmPp}{FfSs}{Gg}{Vv}{Oo}{Tt<n>}] < key.txt \n");
   printf("The input is a list of keys, one key per line.\n");
-  printf("Only one of NnIiHhDdAa and one of MmPp may be specified.\n");
+  printf("Only one of NnIiHhDdXxYyAa and one of MmPp may be specified.\n");
   printf("  N,n: normal mode, key is any string string (default).\n");
   printf("  I,i: initial hash for ASCII char strings.\n");
   printf("The initial hash must be\n");
@@ -1255,6 +2285,8 @@ static void usage_error()
   printf("ffffffff\n");
   printf("This is good for optimizing switch statement compilation.\n");
   printf("  D,d: Same as H,h, except in decimal not hexidecimal\n");
+  printf("  X,x: Keys are 8-byte integers in hex, phash takes a ub8\n");
+  printf("  Y,y: Same as X,x, except in decimal not hexidecimal\n");
   printf("  A,a: An (A,B) pair is supplied in hex in this format:\n");
   printf("aaa bbb\n");
   printf("  B,b: Same as A,a, except in decimal not hexidecimal\n");
@@ -1265,6 +2297,16 @@ static void usage_error()
   printf("and n is a power of 2.  Will probably use a smaller tab[].");
   printf("  F,f: Fast mode.  Generate the perfect hash fast.\n");
   printf("  S,s: Slow mode.  Spend time finding a good perfect hash.\n");
+  printf("  G,g: Build by 3-hypergraph peeling (BDZ) instead of tab[].\n");
+  printf("Linear time, about 2.6 bits per key, for huge key sets.  Mode N only.\n");
+  printf("  V,v: Also write phash_batch(inputs, out, n) to hash n keys at once.\n");
+  printf("Modes H, D, X and Y only.  Uses AVX2 gathers if compiled with -mavx2.\n");
+  printf("  O,o: Also write phashmap[] and phash_find(), a map from keys to values.\n");
+  printf("A line \"key<tab>value\" gives key that value, else it is the line number.\n");
+  printf("Values must be below 0x%lx, which is PHASHNONE.\n", (unsigned long)PHASHNONE);
+  printf("phash_find returns PHASHNONE for keys not in the set.  Not for A,B.\n");
+  printf("  T<n>,t<n>: Try salts with n threads (default: one per CPU).\n");
+  printf("Only when compiled with THREADS, and only for N, I, X and Y modes.\n");
 
   exit(SUCCESS);
 }
@@ -1287,6 +2329,16 @@ char **argv;
   form.hashtype = STRING_HT;
   form.perfect = MINIMAL_HP;
   form.speed = SLOW_HS;
+  form.construct = TAB_HC;
+  form.threads = 1;
+  form.batch = FALSE;
+  form.keymap = FALSE;
+#ifdef THREADS
+  {
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    if (ncpu > 1) form.threads = (ub4)ncpu;
+  }
+#endif
 
   /* let the user override the default behavior */
   switch (argc)
@@ -1307,6 +2359,8 @@ char **argv;
     case 'd': case 'D':
     case 'a': case 'A':
     case 'b': case 'B':
+    case 'x': case 'X':
+    case 'y': case 'Y':
       if (mode_given == TRUE) 
 	usage_error();
       switch(*c)
@@ -1323,6 +2377,10 @@ char **argv;
 	form.mode = AB_HM;      form.hashtype = AB_HT; break;
       case 'b': case 'B':
 	form.mode = ABDEC_HM;   form.hashtype = AB_HT; break;
+      case 'x': case 'X':
+	form.mode = HEX8_HM;    form.hashtype = INT8_HT; break;
+      case 'y': case 'Y':
+	form.mode = DECIMAL8_HM; form.hashtype = INT8_HT; break;
       }
       mode_given = TRUE;
       break;
@@ -1352,6 +2410,22 @@ char **argv;
       }
       speed_given = TRUE;
       break;
+    case 'g': case 'G':
+      form.construct = BDZ_HC;
+      break;
+    case 'v': case 'V':
+      form.batch = TRUE;
+      break;
+    case 'o': case 'O':
+      form.keymap = TRUE;
+      break;
+    case 't': case 'T':
+      form.threads = 0;
+      while (c[1] >= '0' && c[1] <= '9')
+	form.threads = form.threads*10 + (*++c - '0');
+      if (form.threads == 0)
+	usage_error();
+      break;
     default:
       usage_error();
     }
@@ -1360,8 +2434,27 @@ char **argv;
     usage_error();
   }
 
+  if (form.construct == BDZ_HC && form.mode != NORMAL_HM)
+  {
+    printf("G,g only works with normal mode (N,n)\n");
+    usage_error();
+  }
+  if (form.batch && form.mode != HEX_HM && form.mode != DECIMAL_HM &&
+      form.mode != HEX8_HM && form.mode != DECIMAL8_HM)
+  {
+    printf("V,v only works with integer keys (H,h D,d X,x Y,y)\n");
+    usage_error();
+  }
+  if (form.keymap && form.hashtype == AB_HT)
+  {
+    printf("O,o does not work with (A,B) pairs (A,a B,b)\n");
+    usage_error();
+  }
+
   /* Generate the [minimal] perfect hash */
   driver(&form);
 
   return SUCCESS;
 }
+
+#endif /* PERFECT_LIBRARY */
@@ -15,12 +15,12 @@ Source is http://burtleburtle.net/bob/c/perfect.h
 #ifndef PERFECT
 #define PERFECT
 
-#define MAXKEYLEN 30                              /* maximum length of a key */
 #define USE_SCRAMBLE  4096           /* use scramble if blen >= USE_SCRAMBLE */
 #define SCRAMBLE_LEN ((ub4)1<<16)                    /* length of *scramble* */
 #define RETRY_INITKEY 2048  /* number of times to try to find distinct (a,b) */
 #define RETRY_PERFECT 1     /* number of times to try to make a perfect hash */
 #define RETRY_HEX     200               /* RETRY_PERFECT when hex keys given */
+#define REPAIR_EVICT  1024 /* evictions findhash_incr tries before rebuilding */
 
 /* the generated code for the final hash, assumes initial hash is done */
 struct gencode
@@ -58,11 +58,14 @@ struct hashform
     HEX_HM,              /* key to be hashed is a hexidecimal 4-byte integer */
     DECIMAL_HM,              /* key to be hashed is a decimal 4-byte integer */
     AB_HM,      /* key to be hashed is "A B", where A and B are (A,B) in hex */
-    ABDEC_HM                                   /* like AB_HM, but in decimal */
+    ABDEC_HM,                                  /* like AB_HM, but in decimal */
+    HEX8_HM,            /* key to be hashed is a hexidecimal 8-byte integer */
+    DECIMAL8_HM             /* key to be hashed is a decimal 8-byte integer */
   } mode;
   enum {
     STRING_HT,                                            /* key is a string */
     INT_HT,                                             /* key is an integer */
+    INT8_HT,                                    /* key is an 8-byte integer */
     AB_HT             /* dunno what key is, but input is distinct (A,B) pair */
   } hashtype;
   enum {
@@ -73,6 +76,13 @@ struct hashform
     FAST_HS,                                                    /* fast mode */
     SLOW_HS                                                     /* slow mode */
   } speed;
+  enum {
+    TAB_HC,                   /* (a,b) pairs and tab[], built by perfect() */
+    BDZ_HC              /* 3-hypergraph peeling for huge key sets, perfbdz.c */
+  } construct;
+  ub4 threads;               /* threads trying salts at once, with THREADS */
+  word batch;              /* TRUE: also write phash_batch(), integer modes */
+  word keymap;      /* TRUE: also write phashmap[] of fingerprints and values */
 };
 typedef  struct hashform  hashform;
 
@@ -82,6 +92,8 @@ struct key
   ub1        *name_k;                                      /* the actual key */
   ub4         len_k;                         /* the length of the actual key */
   ub4         hash_k;                 /* the initial hash value for this key */
+  ub8         hash8_k;                          /* the key, for INT8_HT keys */
+  ub4         val_k;                  /* value stored with the key, for keymap */
   struct key *next_k;                                            /* next key */
 /* beyond this point is mapping-dependent */
   ub4         a_k;                            /* a, of the key maps to (a,b) */
@@ -117,6 +129,19 @@ struct qstuff
 };
 typedef  struct qstuff  qstuff;
 
+/* a perfect hash built by 3-hypergraph peeling, see perfbdz.c */
+#define BDZ_RANK 128            /* vertices per count of used vertices */
+struct bdz
+{
+  ub4  salt;                                  /* initializes the checksum */
+  ub4  r;                               /* vertices in each third of g[] */
+  ub1 *g;                      /* 2 bits per vertex, 3 if no key uses it */
+  ub4  glen;                                 /* bytes in g[], padded */
+  ub4 *rank;         /* rank[i]: used vertices before vertex i*BDZ_RANK */
+  ub4  nrank;                                          /* length of rank */
+};
+typedef  struct bdz  bdz;
+
 /* return ceiling(log based 2 of x) */
 ub4 mylog2(/*_ ub4 x _*/);
 
@@ -125,8 +150,39 @@ void findhash(/*_ bstuff **tabb, ub4 *alen, ub4 *blen, ub4 *salt,
 		gencode *final, ub4 *scramble, ub4 smax, key *keys, ub4 nkeys, 
 		hashform *form _*/);
 
+/* Like findhash, but reuse an old perfect hash for a changed set of keys */
+word findhash_incr(/*_ bstuff **tabb, ub4 *alen, ub4 *blen, ub4 *salt,
+		     gencode *final, ub4 *scramble, ub4 *smax, key *keys,
+		     ub4 nkeys, hashform *form _*/);
+
+/* private, fn(arg, lo, hi) for slices of 0..n-1 in parallel, with THREADS */
+#define PARFOR_MIN 4096               /* fewest items worth a thread of their own */
+void parfor(/*_ ub4 n, void (*fn)(void *arg, ub4 lo, ub4 hi), void *arg,
+	      ub4 nthreads _*/);
+
+/* private, exit with a message if two keys are the same */
+void dupkeys(/*_ key *keys, ub4 nkeys, hashform *form _*/);
+
+/* private, fill scramble[] with distinct values in 0..smax-1 */
+void scrambleinit(/*_ ub4 *scramble, ub4 smax _*/);
+
 /* private, but in a different file because it's excessively verbose */
 int inithex(/*_ key *keys, ub4 *alen, ub4 *blen, ub4 smax, ub4 nkeys, 
 	      ub4 salt, gencode *final, gencode *form _*/);
 
+/* private, initial hash for 8-byte integer keys, in perfhex.c */
+void inithex8(/*_ key *keys, ub4 alen, ub4 blen, ub4 smax, ub4 salt,
+		gencode *final _*/);
+
+/* private, the BDZ construction and its code generator, in perfbdz.c */
+void findbdz(/*_ bdz *b, key *keys, ub4 nkeys, hashform *form _*/);
+void make_bdz(/*_ bdz *b, key *keys, ub4 nkeys, hashform *form _*/);
+
+/* private, phashmap[] for keymap, used by make_c and make_bdz */
+#define PHASHFP   0x7f4a7c15      /* fingerprint seed for lookup(), arbitrary */
+#define PHASHNONE 0xffffffff            /* phash_find() of a key not in the set */
+void make_map_h(/*_ FILE *f, ub4 maplen, hashform *form _*/);
+void make_map_c(/*_ FILE *f, key *keys, ub4 *rsl, ub4 maplen, 
+		  hashform *form _*/);
+
 #endif /* PERFECT */
@@ -69,6 +69,8 @@ gencode *final;
   if ((a&1) != (b&1))
   {
     sprintf(final->line[0], "  ub4 rsl = (val & 1);\n");         /* h2a: 3,4 */
+    keys->a_k = a&1;                              /* the hash, for keymap */
+    keys->next_k->a_k = b&1;
     return;
   }
 
@@ -78,7 +80,9 @@ gencode *final;
     if ((a&((ub4)1<<i)) != (b&((ub4)1<<i))) break;
   }
   /* h2b: 4,6 */
-  sprintf(final->line[0], "  ub4 rsl = ((val << %ld) & 1);\n", i);
+  sprintf(final->line[0], "  ub4 rsl = ((val >> %ld) & 1);\n", i);
+  keys->a_k = (a>>i)&1;
+  keys->next_k->a_k = (b>>i)&1;
 }
 
 
@@ -1261,7 +1265,8 @@ hashform *form;                                           /* user directives */
 {
   setlow(keys, final);
 
-  switch (nkeys)
+  /* keymap must know the hash of each key, so use a^tab[b] past two keys */
+  switch ((form->keymap && nkeys > 2) ? 0 : nkeys)
   {
   case 1:
     hexone(keys, final);
@@ -1306,3 +1311,60 @@ hashform *form;                                           /* user directives */
     return FALSE;
   }
 }
+
+
+
+/*
+ * 64-bit keys (HEX8_HM, DECIMAL8_HM).  There is no search over mixing
+ * instructions here; a and b are the high bits of the key times two odd
+ * 64-bit multipliers chosen by the salt (multiply-shift hashing), which
+ * costs two multiplies and two shifts and no branches.  Every salt gives
+ * new multipliers, so findhash retries salts as it does for strings.
+ */
+static ub8 hexmix8(x)
+ub8 x;
+{
+  x += (ub8)0x9e3779b97f4a7c15LL;      /* the golden ratio; arbitrary value */
+  x = (x ^ (x >> 30)) * (ub8)0xbf58476d1ce4e5b9LL;
+  x = (x ^ (x >> 27)) * (ub8)0x94d049bb133111ebLL;
+  return x ^ (x >> 31);
+}
+
+void inithex8(keys, alen, blen, smax, salt, final)
+key      *keys;                                          /* list of all keys */
+ub4       alen;                    /* (a,b) has a in 0..alen-1, a power of 2 */
+ub4       blen;                    /* (a,b) has b in 0..blen-1, a power of 2 */
+ub4       smax;                   /* maximum range of computable hash values */
+ub4       salt;                     /* used to initialize the hash function */
+gencode  *final;                          /* output, code for the final hash */
+{
+  ub8  ma = hexmix8((ub8)salt*2) | 1;              /* odd multiplier for a */
+  ub8  mb = hexmix8((ub8)salt*2+1) | 1;            /* odd multiplier for b */
+  ub4  loga = mylog2(alen);
+  ub4  blog = mylog2(blen);
+  key *mykey;
+
+  for (mykey=keys; mykey; mykey=mykey->next_k)
+  {
+    mykey->a_k = loga ? (ub4)((mykey->hash8_k*ma) >> (UB8BITS-loga)) : 0;
+    mykey->b_k = blog ? (ub4)((mykey->hash8_k*mb) >> (UB8BITS-blog)) : 0;
+  }
+
+  final->used = 3;
+  if (loga)
+    sprintf(final->line[0], "  ub4 a = (ub4)((val*(ub8)0x%.16llxLL)>>%ld);\n",
+	    ma, UB8BITS-loga);
+  else
+    sprintf(final->line[0], "  ub4 a = 0;\n");
+  if (blog)
+    sprintf(final->line[1], "  ub4 b = (ub4)((val*(ub8)0x%.16llxLL)>>%ld);\n",
+	    mb, UB8BITS-blog);
+  else
+    sprintf(final->line[1], "  ub4 b = 0;\n");
+  if (smax <= 1)
+    sprintf(final->line[2], "  ub4 rsl = 0;\n");
+  else if (blen < USE_SCRAMBLE)
+    sprintf(final->line[2], "  ub4 rsl = (a^tab[b]);\n");
+  else
+    sprintf(final->line[2], "  ub4 rsl = (a^scramble[tab[b]]);\n");
+}
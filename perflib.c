@@ -0,0 +1,385 @@
+/*
+------------------------------------------------------------------------------
+perflib.c: build and use perfect hashes at runtime, see perflib.h.
+You may use this code in any way you wish, and it is free.  No warranty.
+
+The lookups here compute exactly what the phash() written by make_c or
+make_bdz would compute, but read their constants from the image instead
+of having them compiled in.  The image is one block: a phashhdr, then
+tab[], then rank[], each at an 8-byte aligned offset.  For TAB_HC, tab[]
+already holds scramble[val_b], so no scramble[] is stored.
+------------------------------------------------------------------------------
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifndef STANDARD
+#include "standard.h"
+#endif
+#ifndef LOOKUPA
+#include "lookupa.h"
+#endif
+#ifndef RECYCLE
+#include "recycle.h"
+#endif
+#ifndef PERFECT
+#include "perfect.h"
+#endif
+#ifndef PERFLIB
+#include "perflib.h"
+#endif
+
+#define phalign(x) (((x)+7) & ~(ub4)7)
+
+/* allocate an image and a phash_t pointing into it */
+static phash_t *phalloc( phashhdr *h )
+{
+  phash_t *p = (phash_t *)remalloc(sizeof(phash_t), "perflib.c, phash_t");
+
+  h->magic = PHASH_MAGIC;
+  h->version = PHASH_VERSION;
+  h->wordsize = sizeof(ub4);
+  h->taboff = phalign(sizeof(phashhdr));
+  h->rankoff = phalign(h->taboff + h->tablen*h->tabw);
+  h->length = h->rankoff + h->ranklen*sizeof(ub4);
+  p->hdr = (phashhdr *)remalloc((size_t)h->length, "perflib.c, image");
+  memset((void *)p->hdr, 0, (size_t)h->length);
+  *p->hdr = *h;
+  p->tab = (ub1 *)p->hdr + h->taboff;
+  p->rank = (ub4 *)((ub1 *)p->hdr + h->rankoff);
+  p->maplen = 0;
+  return p;
+}
+
+/* store the final tab[] of a TAB_HC hash, already scrambled */
+static phash_t *phtab( phashhdr *h, bstuff *tab, ub4 *scramble )
+{
+  phash_t *p;
+  ub4      i, big = 0;
+
+  for (i=0; i<h->blen; ++i)
+    if (scramble[tab[i].val_b] > big) big = scramble[tab[i].val_b];
+  h->tabw = (big <= UB1MAXVAL) ? 1 : (big <= UB2MAXVAL) ? 2 : sizeof(ub4);
+  h->tablen = h->blen;
+  h->ranklen = 0;
+  p = phalloc(h);
+  for (i=0; i<h->blen; ++i)
+  {
+    ub4 v = scramble[tab[i].val_b];
+    switch (h->tabw)
+    {
+    case 1:  p->tab[i] = (ub1)v; break;
+    case 2:  ((ub2 *)p->tab)[i] = (ub2)v; break;
+    default: ((ub4 *)p->tab)[i] = v; break;
+    }
+  }
+  return p;
+}
+
+/* the directives for a build, and the keys as the list findhash takes */
+static reroot *phsetup( ub1 **keys, ub4 *lens, ub4 n, hashform *opts,
+			hashform *form, key **keylist )
+{
+  reroot *keyroot;
+  ub4     i;
+
+  if (opts)
+    *form = *opts;
+  else
+  {
+    form->perfect = MINIMAL_HP;
+    form->speed = SLOW_HS;
+    form->construct = TAB_HC;
+    form->threads = 1;
+    form->batch = FALSE;
+    form->keymap = FALSE;
+  }
+  form->mode = NORMAL_HM;
+  form->hashtype = STRING_HT;
+
+  keyroot = remkroot(sizeof(key));
+  relabel(keyroot, "perflib.c, key");
+  *keylist = (key *)0;
+  for (i=n; i--;)
+  {
+    key *mykey = (key *)renew(keyroot);
+    mykey->name_k = keys[i];
+    mykey->len_k = lens[i];
+    mykey->next_k = *keylist;
+    *keylist = mykey;
+  }
+  return keyroot;
+}
+
+/* the header of a TAB_HC hash from what findhash found */
+static void phtabhdr( phashhdr *h, hashform *form, ub4 n, ub4 alen,
+		      ub4 blen, ub4 salt, ub4 smax )
+{
+  memset((void *)h, 0, sizeof(*h));
+  h->construct = TAB_HC;
+  h->minimal = (form->perfect == MINIMAL_HP);
+  h->nkeys = n;
+  h->initlev = salt*0x9e3779b9;
+  h->alen = alen;
+  h->blen = blen;
+  h->check = (blen > 0 && mylog2(alen)+mylog2(blen) > UB4BITS);
+  h->range = h->minimal ? n : smax;
+  h->salt = salt;
+  h->smax = smax;
+}
+
+phash_t *phash_build( ub1 **keys, ub4 *lens, ub4 n, hashform *opts )
+{
+  hashform  form;
+  phashhdr  h;
+  phash_t  *p;
+  reroot   *keyroot;
+  key      *keylist;
+  ub4       i;
+
+  keyroot = phsetup(keys, lens, n, opts, &form, &keylist);
+
+  memset((void *)&h, 0, sizeof(h));
+  h.construct = form.construct;
+  h.minimal = (form.perfect == MINIMAL_HP);
+  h.nkeys = n;
+
+  if (form.construct == BDZ_HC)
+  {
+    bdz b;
+    findbdz(&b, keylist, n, &form);
+    h.initlev = b.salt*0x9e3779b9;
+    h.r = b.r;
+    h.range = h.minimal ? n : 3*b.r;
+    h.tabw = 1;
+    h.tablen = b.glen;
+    h.ranklen = h.minimal ? b.nrank : 0;
+    p = phalloc(&h);
+    memcpy((void *)p->tab, (void *)b.g, (size_t)b.glen);
+    if (h.minimal)
+      memcpy((void *)p->rank, (void *)b.rank, sizeof(ub4)*b.nrank);
+    free((void *)b.g);
+    if (b.rank) free((void *)b.rank);
+  }
+  else
+  {
+    bstuff  *tab;
+    ub4      alen, blen, salt, smax;
+    ub4     *scramble;
+    gencode  final;
+    char     buf[10][80];
+    char    *line[10];
+
+    final.line = line;
+    final.used = 0;
+    final.len = 10;
+    for (i=0; i<10; ++i) final.line[i] = buf[i];
+    scramble = (ub4 *)remalloc(sizeof(ub4)*SCRAMBLE_LEN, "perflib.c, scramble");
+
+    findhash(&tab, &alen, &blen, &salt, &final,
+	     scramble, &smax, keylist, n, &form);
+
+    phtabhdr(&h, &form, n, alen, blen, salt, smax);
+    p = phtab(&h, tab, scramble);
+    free((void *)tab);
+    free((void *)scramble);
+  }
+
+  refree(keyroot);
+  return p;
+}
+
+/* for finding which scramble[] entry a tab[] value came from */
+struct phinv
+{
+  ub4 val;                                                /* scramble[i] */
+  ub4 i;
+};
+typedef  struct phinv  phinv;
+
+static int phinvcmp( const void *x, const void *y )
+{
+  ub4 a = ((const phinv *)x)->val;
+  ub4 b = ((const phinv *)y)->val;
+  return (a < b) ? -1 : (a > b);
+}
+
+phash_t *phash_rebuild( phash_t *old, ub1 **keys, ub4 *lens, ub4 n,
+			hashform *opts )
+{
+  phashhdr *oh = old->hdr;
+  hashform  form;
+  phashhdr  h;
+  phash_t  *p;
+  reroot   *keyroot;
+  key      *keylist;
+  bstuff   *tab;
+  ub4      *scramble;
+  phinv    *inv;
+  ub4       alen = oh->alen, blen = oh->blen, salt = oh->salt;
+  ub4       smax = oh->smax;
+  ub4       i, ninv;
+  gencode   final;
+  char      buf[10][80];
+  char     *line[10];
+
+  keyroot = phsetup(keys, lens, n, opts, &form, &keylist);
+  if (oh->construct != TAB_HC || form.construct != TAB_HC || blen == 0 ||
+      (oh->minimal != 0) != (form.perfect == MINIMAL_HP))
+  {
+    refree(keyroot);
+    return phash_build(keys, lens, n, opts);
+  }
+
+  final.line = line;
+  final.used = 0;
+  final.len = 10;
+  for (i=0; i<10; ++i) final.line[i] = buf[i];
+  scramble = (ub4 *)remalloc(sizeof(ub4)*SCRAMBLE_LEN, "perflib.c, scramble");
+  tab = (bstuff *)remalloc(sizeof(bstuff)*blen, "perflib.c, tab");
+
+  /* the image holds scramble[val_b]; invert scramble[] to get val_b back */
+  scrambleinit(scramble, smax);
+  ninv = (blen >= USE_SCRAMBLE) ? UB1MAXVAL+1 :
+         (smax < SCRAMBLE_LEN) ? smax : SCRAMBLE_LEN;
+  inv = (phinv *)remalloc(sizeof(phinv)*ninv, "perflib.c, inv");
+  for (i=0; i<ninv; ++i)
+  {
+    inv[i].val = scramble[i];
+    inv[i].i = i;
+  }
+  qsort((void *)inv, (size_t)ninv, sizeof(phinv), phinvcmp);
+  for (i=0; i<blen; ++i)
+  {
+    phinv  want;
+    phinv *got;
+    switch (oh->tabw)
+    {
+    case 1:  want.val = old->tab[i]; break;
+    case 2:  want.val = ((ub2 *)old->tab)[i]; break;
+    default: want.val = ((ub4 *)old->tab)[i]; break;
+    }
+    got = (phinv *)bsearch((void *)&want, (void *)inv, (size_t)ninv,
+			   sizeof(phinv), phinvcmp);
+    tab[i].val_b = got ? (ub2)got->i : 0;
+  }
+  free((void *)inv);
+
+  (void)findhash_incr(&tab, &alen, &blen, &salt, &final,
+		      scramble, &smax, keylist, n, &form);
+
+  phtabhdr(&h, &form, n, alen, blen, salt, smax);
+  p = phtab(&h, tab, scramble);
+  free((void *)tab);
+  free((void *)scramble);
+  refree(keyroot);
+  return p;
+}
+
+ub4 phash_lookup( phash_t *p, ub1 *key, ub4 len )
+{
+  phashhdr *h = p->hdr;
+  ub4       a, b, i, state[CHECKSTATE];
+
+  if (h->construct == BDZ_HC)
+  {                                               /* as make_bdz's phash() */
+    ub4 v[3], rsl;
+    for (i=0; i<CHECKSTATE; ++i) state[i] = h->initlev;
+    checksum(key, len, state);
+    for (i=0; i<3; ++i)
+      v[i] = (ub4)((((ub8)(state[i]&0xffffffff))*h->r)>>32) + i*h->r;
+#define PHG(v) ((p->tab[(v)>>2] >> (((v)&3)<<1)) & 3)
+    rsl = v[(PHG(v[0]) + PHG(v[1]) + PHG(v[2])) % 3];
+    if (!h->minimal) return rsl;
+    v[0] = rsl;
+    rsl = p->rank[v[0]/BDZ_RANK];
+    for (i=(v[0]&~(BDZ_RANK-1))>>2; i<(v[0]>>2); ++i)
+    {
+      v[1] = p->tab[i] & (p->tab[i]>>1) & 0x55;     /* 1 per unused vertex */
+      rsl += 4 - (v[1]&1) - ((v[1]>>2)&1) - ((v[1]>>4)&1) - (v[1]>>6);
+    }
+    for (i=v[0]&~3; i<v[0]; ++i)
+      if (PHG(i) != 3) ++rsl;
+#undef PHG
+    return rsl;
+  }
+
+  /* as make_c's phash() for NORMAL_HM */
+  if (h->blen == 0) return 0;
+  if (h->check)
+  {
+    for (i=0; i<CHECKSTATE; ++i) state[i] = h->initlev;
+    checksum(key, len, state);
+    a = state[0] & (h->alen-1);
+    b = state[1] & (h->blen-1);
+  }
+  else
+  {
+    ub4 val = lookup(key, len, h->initlev);
+    a = (h->alen > 1) ? (val >> (UB4BITS-mylog2(h->alen))) : 0;
+    b = val & (h->blen-1);
+  }
+  switch (h->tabw)
+  {
+  case 1:  return a ^ p->tab[b];
+  case 2:  return a ^ ((ub2 *)p->tab)[b];
+  default: return a ^ ((ub4 *)p->tab)[b];
+  }
+}
+
+word phash_save( phash_t *p, char *filename )
+{
+  FILE *f = fopen(filename, "wb");
+  word  ok;
+
+  if (!f) return FALSE;
+  ok = (fwrite((void *)p->hdr, (size_t)p->hdr->length, 1, f) == 1);
+  if (fclose(f)) ok = FALSE;
+  return ok;
+}
+
+phash_t *phash_load( char *filename )
+{
+  struct stat st;
+  phashhdr   *h;
+  phash_t    *p;
+  int         fd = open(filename, O_RDONLY);
+
+  if (fd < 0) return (phash_t *)0;
+  if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(phashhdr))
+  {
+    close(fd);
+    return (phash_t *)0;
+  }
+  h = (phashhdr *)mmap((void *)0, (size_t)st.st_size, PROT_READ, MAP_SHARED,
+		       fd, 0);
+  close(fd);
+  if (h == (phashhdr *)MAP_FAILED) return (phash_t *)0;
+  if (h->magic != PHASH_MAGIC || h->version != PHASH_VERSION ||
+      h->wordsize != sizeof(ub4) || h->length != (ub4)st.st_size ||
+      h->taboff + h->tablen*h->tabw > h->length ||
+      h->rankoff + h->ranklen*sizeof(ub4) > h->length)
+  {
+    munmap((void *)h, (size_t)st.st_size);
+    return (phash_t *)0;
+  }
+  p = (phash_t *)remalloc(sizeof(phash_t), "perflib.c, phash_t");
+  p->hdr = h;
+  p->tab = (ub1 *)h + h->taboff;
+  p->rank = (ub4 *)((ub1 *)h + h->rankoff);
+  p->maplen = (size_t)st.st_size;
+  return p;
+}
+
+void phash_free( phash_t *p )
+{
+  if (p->maplen)
+    munmap((void *)p->hdr, p->maplen);
+  else
+    free((void *)p->hdr);
+  free((void *)p);
+}
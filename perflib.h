@@ -0,0 +1,118 @@
+/*
+------------------------------------------------------------------------------
+perflib.h: build and use perfect hashes at runtime instead of generating code.
+You may use this code in any way you wish, and it is free.  No warranty.
+
+perfect writes phash.h and phash.c, which have to be compiled in.  This
+does the same search (findhash, or findbdz for -g) in-process and keeps
+the result in one flat image, which can be written to a file and later
+mapped back in read-only, so many processes can share one table.
+
+  phash_build  - find a perfect hash for an array of string keys
+  phash_rebuild - find a perfect hash for a changed set of keys, reusing
+                  an old one as far as possible
+  phash_lookup - hash a key
+  phash_range  - hashes are in 0..phash_range()-1
+  phash_save   - write the image to a file
+  phash_load   - mmap an image written by phash_save
+  phash_free   - free or unmap a perfect hash
+
+Like perfect, building prints progress to stdout and exits on a fatal
+error (such as duplicate keys).  Lookups of keys that were not in the
+set return some hash in range, so check the key if that matters.
+Images are in native byte order and word size; phash_load refuses
+images from a machine that differs.
+------------------------------------------------------------------------------
+*/
+
+#ifndef STANDARD
+#include "standard.h"
+#endif
+#ifndef PERFECT
+#include "perfect.h"
+#endif
+
+#ifndef PERFLIB
+#define PERFLIB
+
+#define PHASH_MAGIC   0x68736870              /* "phsh" in little-endian */
+#define PHASH_VERSION 2
+
+/* private - the start of an image; offsets are from the start of the image */
+struct phashhdr
+{
+  ub4  magic;                                             /* PHASH_MAGIC */
+  ub4  version;                                         /* PHASH_VERSION */
+  ub4  wordsize;                /* sizeof(ub4) on the machine that built it */
+  ub4  length;                            /* bytes in the whole image */
+  ub4  construct;                            /* TAB_HC or BDZ_HC, see hashform */
+  ub4  minimal;                       /* TRUE if hashes are 0..nkeys-1 */
+  ub4  nkeys;                                   /* number of keys hashed */
+  ub4  range;                            /* hashes are in 0..range-1 */
+  ub4  initlev;                       /* initial value for lookup/checksum */
+  ub4  alen;                         /* TAB_HC: a is in 0..alen-1, or 0 */
+  ub4  blen;                         /* TAB_HC: b is in 0..blen-1, or 0 */
+  ub4  check;                 /* TAB_HC: TRUE if (a,b) come from checksum */
+  ub4  r;                          /* BDZ_HC: vertices in each third of g */
+  ub4  tabw;                          /* bytes per tab entry, 1, 2 or 4 */
+  ub4  tablen;                                    /* entries in tab */
+  ub4  taboff;                                /* offset of tab in image */
+  ub4  ranklen;                             /* BDZ_HC: entries in rank */
+  ub4  rankoff;                              /* offset of rank in image */
+  ub4  salt;                     /* TAB_HC: the salt findhash settled on */
+  ub4  smax;                     /* TAB_HC: scramble[] values are < smax */
+};
+typedef  struct phashhdr  phashhdr;
+
+/* a perfect hash that can be used at runtime */
+struct phash_t
+{
+  phashhdr *hdr;                        /* the image, header comes first */
+  ub1      *tab;                   /* TAB_HC: final tab[]; BDZ_HC: g[] */
+  ub4      *rank;                      /* BDZ_HC minimal: used vertices */
+  size_t    maplen;                /* length mapped by phash_load, or 0 */
+};
+typedef  struct phash_t  phash_t;
+
+/* phash_build - find a perfect hash for a set of keys
+   ARGUMENTS:
+     keys - keys[i] is the i-th key, they must all be distinct
+     lens - lens[i] is the length of keys[i]
+     n    - number of keys
+     opts - the same directives perfect takes, or 0 for perfect's defaults
+            (minimal, slow).  Only NORMAL_HM string keys are supported.
+   RETURNS:
+     the new perfect hash.  The keys are not needed afterward.
+ */
+phash_t *phash_build( ub1 **keys, ub4 *lens, ub4 n, hashform *opts );
+
+/* phash_rebuild - find a perfect hash for a new set of keys, starting
+   from an old perfect hash of a similar set
+   ARGUMENTS:
+     old  - a perfect hash from phash_build, phash_rebuild or phash_load.
+            It is not changed; free it when done with it.
+     keys, lens, n, opts - as for phash_build, but the complete new set
+   RETURNS:
+     the new perfect hash.  For a TAB_HC hash, the old salt and tab[]
+     are kept and only the entries the changed keys disturb are remapped,
+     which is usually several times faster than phash_build when few
+     keys changed.  Otherwise, or if remapping fails, this is phash_build.
+ */
+phash_t *phash_rebuild( phash_t *old, ub1 **keys, ub4 *lens, ub4 n,
+                        hashform *opts );
+
+/* phash_lookup - the perfect hash of a key */
+ub4 phash_lookup( phash_t *p, ub1 *key, ub4 len );
+
+#define phash_range(p) ((p)->hdr->range)
+
+/* phash_save - write p to a file.  Returns FALSE on failure. */
+word phash_save( phash_t *p, char *filename );
+
+/* phash_load - map a file written by phash_save.  Returns 0 on failure. */
+phash_t *phash_load( char *filename );
+
+/* phash_free - free a perfect hash from phash_build or phash_load */
+void phash_free( phash_t *p );
+
+#endif /* PERFLIB */
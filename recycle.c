@@ -10,6 +10,12 @@ Timings have shown that, if malloc is used for every new structure,
   module cuts down the number of mallocs by an order of magnitude.
 This also decreases memory fragmentation, and freeing structures
   only requires freeing the root.
+
+With THREADS, blocks are got by reget and given back by reput.  Block
+  lengths are rounded up to a size class (REMINBLOCK<<k), and a thread
+  keeps up to RECACHED free blocks of each class without locking.  Past
+  that they go to a depot shared by all threads, and past that back to
+  the system.  Threads that exit give their cached blocks to the depot.
 --------------------------------------------------------------------
 */
 
@@ -20,28 +26,260 @@ This also decreases memory fragmentation, and freeing structures
 # include "recycle.h"
 #endif
 
+#ifdef THREADS
+# include <pthread.h>
+# include <sys/mman.h>
+# define REGROW  REBIG
+#else
+# define REGROW  REMAX
+#endif
+
+#ifdef THREADS
+
+#define REMINBLOCK ((size_t)1<<12)  /* smallest size class */
+#define RECLASSES  24               /* size classes REMINBLOCK<<0..<<23 */
+#define RECACHED   4                /* free blocks per class per thread */
+#define REDEPOT    16               /* free blocks per class in the depot */
+
+static __thread reblock *recache[RECLASSES]; /* this thread's free blocks */
+static __thread word     recount[RECLASSES]; /* how many of each class */
+static __thread word     rehascache;         /* has this thread cached any? */
+static __thread char     reme;          /* its address identifies a thread */
+
+static reblock          *redepot[RECLASSES]; /* free blocks for any thread */
+static word              redepotn[RECLASSES];
+static pthread_mutex_t   relock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t     rekey;            /* just to hear of thread exit */
+static pthread_once_t    reonce = PTHREAD_ONCE_INIT;
+static word              rehuge = FALSE;   /* try huge pages? */
+
+void  rehugepages(on)
+word  on;
+{
+   rehuge = on;
+}
+
+/* smallest class holding len bytes, or -1 if len is too big for any */
+static word  reclass(len)
+size_t  len;
+{
+   word k;
+   for (k=0; k<RECLASSES; ++k)
+      if ((REMINBLOCK<<k) >= len) return k;
+   return -1;
+}
+
+/* get len bytes from the system */
+static reblock *reos(len)
+size_t  len;
+{
+   reblock *b;
+   if (len < REHUGE)
+      return (reblock *)remalloc(len, "recycle.c, data");
+   b = (reblock *)MAP_FAILED;
+#ifdef MAP_HUGETLB
+   if (rehuge)
+      b = (reblock *)mmap((void *)0, len, PROT_READ|PROT_WRITE,
+                          MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB, -1, 0);
+#endif
+   if (b == (reblock *)MAP_FAILED)
+   {  /* no huge pages reserved; ask for transparent ones instead */
+      b = (reblock *)mmap((void *)0, len, PROT_READ|PROT_WRITE,
+                          MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+      if (b == (reblock *)MAP_FAILED)
+      {
+         fprintf(stderr, "mmap of %lu failed for recycle.c, data\n",
+                 (unsigned long)len);
+         exit(SUCCESS);
+      }
+#ifdef MADV_HUGEPAGE
+      if (rehuge) (void)madvise((void *)b, len, MADV_HUGEPAGE);
+#endif
+   }
+   return b;
+}
+
+/* give a block back to the system */
+static void  reunos(b)
+reblock *b;
+{
+   if (b->len < REHUGE) free((char *)b);
+   else (void)munmap((void *)b, b->len);
+}
+
+/* a thread is exiting: give its cached blocks to the depot */
+static void  reexit(arg)
+void  *arg;
+{
+   word     k;
+   reblock *b;
+   for (k=0; k<RECLASSES; ++k)
+   {
+      while ((b = recache[k]))
+      {
+         recache[k] = b->next;
+         pthread_mutex_lock(&relock);
+         if (redepotn[k] < REDEPOT)
+         {
+            b->next = redepot[k];
+            __atomic_store_n(&redepot[k], b, __ATOMIC_RELAXED);
+            ++redepotn[k];
+            b = (reblock *)0;
+         }
+         pthread_mutex_unlock(&relock);
+         if (b) reunos(b);
+      }
+      recount[k] = 0;
+   }
+}
+
+static void  reinit()
+{
+   (void)pthread_key_create(&rekey, reexit);
+}
+
+/* get a block of at least len bytes, header included */
+static reblock *reget(len)
+size_t  len;
+{
+   reblock *b = (reblock *)0;
+   word     k = reclass(len);
+   if (k >= 0)
+   {
+      len = REMINBLOCK<<k;
+      if ((b = recache[k]))
+      {
+         recache[k] = b->next;
+         --recount[k];
+      }
+      else if (__atomic_load_n(&redepot[k], __ATOMIC_RELAXED))
+      {
+         pthread_mutex_lock(&relock);
+         if ((b = redepot[k]))
+         {
+            __atomic_store_n(&redepot[k], b->next, __ATOMIC_RELAXED);
+            --redepotn[k];
+         }
+         pthread_mutex_unlock(&relock);
+      }
+   }
+   if (!b) b = reos(len);
+   b->len = len;
+   return b;
+}
+
+/* give back a block that reget returned */
+static void  reput(b)
+reblock *b;
+{
+   word k = reclass(b->len);
+   if (k < 0 || (REMINBLOCK<<k) != b->len)
+   {
+      reunos(b);
+      return;
+   }
+   if (recount[k] < RECACHED)
+   {
+      if (!rehascache)
+      {  /* make sure reexit gets called when this thread ends */
+         (void)pthread_once(&reonce, reinit);
+         (void)pthread_setspecific(rekey, (void *)&reme);
+         rehascache = TRUE;
+      }
+      b->next = recache[k];
+      recache[k] = b;
+      ++recount[k];
+      return;
+   }
+   pthread_mutex_lock(&relock);
+   if (redepotn[k] < REDEPOT)
+   {
+      b->next = redepot[k];
+      __atomic_store_n(&redepot[k], b, __ATOMIC_RELAXED);
+      ++redepotn[k];
+      b = (reblock *)0;
+   }
+   pthread_mutex_unlock(&relock);
+   if (b) reunos(b);
+}
+
+#else  /* THREADS */
+
+static reblock *reget(len)
+size_t  len;
+{
+   reblock *b = (reblock *)remalloc(len, "recycle.c, data");
+   b->len = len;
+   return b;
+}
+
+#define reput(b) free((char *)(b))
+
+#endif /* THREADS */
+
+#ifdef RESTATS
+# ifdef THREADS
+#  define READD(x,n) ((void)__atomic_add_fetch(&(x), (n), __ATOMIC_RELAXED))
+static pthread_mutex_t reglock = PTHREAD_MUTEX_INITIALIZER;
+#  define REGLOCK()   pthread_mutex_lock(&reglock)
+#  define REGUNLOCK() pthread_mutex_unlock(&reglock)
+# else
+#  define READD(x,n) ((void)((x) += (n)))
+#  define REGLOCK()
+#  define REGUNLOCK()
+# endif
+static reroot *reroots = (reroot *)0;    /* registry of every live root */
+#endif
+
 reroot *remkroot(size)
 size_t  size;
 {
    reroot *r = (reroot *)remalloc(sizeof(reroot), "recycle.c, root");
-   r->list = (recycle *)0;
+   r->list = (reblock *)0;
    r->trash = (recycle *)0;
+   r->spare = (reblock *)0;
    r->size = align(size);
    r->logsize = RESTART;
    r->numleft = 0;
+#ifdef THREADS
+   r->owner = (void *)&reme;
+   r->remote = (recycle *)0;
+#endif
+#ifdef RESTATS
+   r->label = (char *)0;
+   r->blocks = r->nspare = r->bytes = r->live = r->ntrash = r->peak = 0;
+   REGLOCK();
+   r->rprev = (reroot *)0;
+   if ((r->rnext = reroots)) reroots->rprev = r;
+   reroots = r;
+   REGUNLOCK();
+#endif
    return r;
 }
 
 void  refree(r)
 struct reroot *r;
 {
-   recycle *temp;
-   if (temp = r->list) while (r->list)
+   reblock *temp;
+#ifdef RESTATS
+   REGLOCK();
+   if (r->rnext) r->rnext->rprev = r->rprev;
+   if (r->rprev) r->rprev->rnext = r->rnext;
+   else reroots = r->rnext;
+   REGUNLOCK();
+#endif
+   while (r->list)
    {
       temp = r->list->next;
-      free((char *)r->list);
+      reput(r->list);
       r->list = temp;
    }
+   while (r->spare)
+   {
+      temp = r->spare->next;
+      reput(r->spare);
+      r->spare = temp;
+   }
    free((char *)r);
    return;
 }
@@ -51,26 +289,188 @@ char  *renewx(r)
 struct reroot *r;
 {
    recycle *temp;
+#ifdef RESTATS
+   if (r->numleft)
+   {  /* the fast path of renew, which RESTATS routes through here */
+      temp = (recycle *)((char *)(r->list+1)+(r->numleft-=r->size));
+      goto counted;
+   }
+#endif
+#ifdef THREADS
+   if (!r->trash && __atomic_load_n(&r->remote, __ATOMIC_RELAXED))
+   {
+      r->trash = __atomic_exchange_n(&r->remote, (recycle *)0,
+                                     __ATOMIC_ACQUIRE);
+#ifdef RESTATS
+      for (temp = r->trash; temp; temp = temp->next) ++r->ntrash;
+#endif
+   }
+#endif
    if (r->trash)
    {  /* pull a node off the trash heap */
       temp = r->trash;
       r->trash = temp->next;
       (void)memset((void *)temp, 0, r->size);
+#ifdef RESTATS
+      --r->ntrash;
+#endif
    }
    else
-   {  /* allocate a new block of nodes */
-      r->numleft = r->size*((ub4)1<<r->logsize);
-      if (r->numleft < REMAX) ++r->logsize;
-      temp = (recycle *)remalloc(sizeof(recycle) + r->numleft, 
-				 "recycle.c, data");
-      temp->next = r->list;
-      r->list = temp;
+   {  /* reuse a spare block, or allocate a new block of nodes */
+      reblock *b;
+      if (r->spare)
+      {
+         b = r->spare;
+         r->spare = b->next;
+#ifdef RESTATS
+         --r->nspare;
+         ++r->blocks;
+#endif
+      }
+      else
+      {
+         size_t len = r->size*((ub4)1<<r->logsize);
+         if (len < REGROW) ++r->logsize;
+         b = reget(sizeof(reblock) + len);
+#ifdef RESTATS
+         ++r->blocks;
+         r->bytes += b->len;
+#endif
+      }
+      /* use all of the block, which may have been rounded up */
+      r->numleft = ((b->len - sizeof(reblock))/r->size)*r->size;
+      b->next = r->list;
+      r->list = b;
       r->numleft-=r->size;
       temp = (recycle *)((char *)(r->list+1)+r->numleft);
    }
+#ifdef RESTATS
+counted:
+   READD(r->live, 1);
+   if (r->live > r->peak) r->peak = r->live;
+#endif
    return (char *)temp;
 }
 
+/* move blocks from the list to the spares, up to but not including stop */
+static void  respare(r, stop)
+struct reroot  *r;
+struct reblock *stop;
+{
+   reblock *b;
+   while ((b = r->list) != stop)
+   {
+      r->list = b->next;
+      b->next = r->spare;
+      r->spare = b;
+#ifdef RESTATS
+      --r->blocks;
+      ++r->nspare;
+#endif
+   }
+}
+
+void  rereset(r)
+struct reroot *r;
+{
+   respare(r, (reblock *)0);
+   r->trash = (recycle *)0;
+   r->numleft = 0;
+#ifdef THREADS
+   (void)__atomic_exchange_n(&r->remote, (recycle *)0, __ATOMIC_ACQUIRE);
+#endif
+#ifdef RESTATS
+   r->live = r->ntrash = 0;
+#endif
+}
+
+void  remark(r, f)
+struct reroot  *r;
+struct reframe *f;
+{
+   f->list = r->list;
+   f->numleft = r->numleft;
+   f->trash = r->trash;
+   r->trash = (recycle *)0;
+#ifdef RESTATS
+   f->live = r->live;
+   f->ntrash = r->ntrash;
+   r->ntrash = 0;
+#endif
+}
+
+void  rerewind(r, f)
+struct reroot  *r;
+struct reframe *f;
+{
+   respare(r, f->list);
+   r->numleft = f->numleft;
+   r->trash = f->trash;
+#ifdef THREADS
+   (void)__atomic_exchange_n(&r->remote, (recycle *)0, __ATOMIC_ACQUIRE);
+#endif
+#ifdef RESTATS
+   r->live = f->live;
+   r->ntrash = f->ntrash;
+#endif
+}
+
+#if defined(THREADS) || defined(RESTATS)
+/* redel as a function; with THREADS only the owner touches the trash */
+void  redelx(r, item)
+struct reroot *r;
+char          *item;
+{
+   recycle *x = (recycle *)item;
+#ifdef RESTATS
+   READD(r->live, -1);
+#endif
+#ifdef THREADS
+   if (r->owner != (void *)&reme)
+   {
+      x->next = __atomic_load_n(&r->remote, __ATOMIC_RELAXED);
+      while (!__atomic_compare_exchange_n(&r->remote, &x->next, x, TRUE,
+                                          __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+         ;
+      return;
+   }
+#endif
+   x->next = r->trash;
+   r->trash = x;
+#ifdef RESTATS
+   ++r->ntrash;
+#endif
+}
+#endif
+
+#ifdef RESTATS
+void  restat(r)
+struct reroot *r;
+{
+   printf("%-24s size %6lu  blocks %6lu  spare %6lu  bytes %10lu  live %9lu  trash %9lu  peak %9lu\n",
+          r->label ? r->label : "(unlabeled)",
+          (unsigned long)r->size, (unsigned long)r->blocks,
+          (unsigned long)r->nspare,
+          (unsigned long)r->bytes, (unsigned long)r->live,
+          (unsigned long)r->ntrash, (unsigned long)r->peak);
+}
+
+void  restatall()
+{
+   reroot *r;
+   size_t  roots = 0, bytes = 0;
+   REGLOCK();
+   for (r = reroots; r; r = r->rnext)
+   {
+      restat(r);
+      ++roots;
+      bytes += r->bytes;
+   }
+   REGUNLOCK();
+   printf("roots %lu  bytes %lu\n", (unsigned long)roots, (unsigned long)bytes);
+}
+#endif
+
 char   *remalloc(len, purpose)
 size_t  len;
 char   *purpose;
@@ -84,4 +484,3 @@ char   *purpose;
   }
   return x;
 }
-
@@ -10,6 +10,34 @@ Timings have shown that, if malloc is used for every new structure,
   module cuts down the number of mallocs by an order of magnitude.
 This also decreases memory fragmentation, and freeing all structures
   only requires freeing the root.
+
+Compiled with -DTHREADS, blocks come from a thread-caching layer instead:
+  block sizes are rounded up to power-of-two size classes, blocks freed
+  by refree are kept per thread (and then in a shared depot) for reuse
+  by the next root of any type, blocks keep doubling up to REBIG bytes,
+  blocks of REHUGE bytes or more are mmapped and may be backed by huge
+  pages (see rehugepages), and an item may be redel'd by any thread.
+  Items deleted by a thread other than the one that made the root wait
+  on a lock-free list until the next renewx picks them up.  Calls to
+  renew on one root must still not overlap.
+
+Compiled with -DRESTATS, every root counts its blocks in use, its spare
+  blocks, bytes, live items, trashed items and the peak number of live
+  items, and every root is kept in a registry.  restat prints one root,
+  restatall prints all of them.  Roots that restatall still shows at exit
+  were never refreed.  relabel names a root so restat can say what it
+  holds.  renew is a function call in this mode.
+
+rereset empties a root but keeps its blocks for the next renews, so a
+  root can serve one request after another without calling malloc.
+  remark and rerewind do the same for everything renewed since a mark:
+    reframe f;
+    remark(r, &f);
+    ... renew from r ...
+    rerewind(r, &f);
+  Marks nest.  While a mark is active the trash from before it is set
+  aside, and items from before the mark that are redel'd before the
+  rewind are not reused until the next rereset.
 --------------------------------------------------------------------
 */
 
@@ -22,6 +50,8 @@ This also decreases memory fragmentation, and freeing all structures
 
 #define RESTART    0
 #define REMAX      32000
+#define REBIG      ((size_t)1<<22)       /* with THREADS, blocks grow to this */
+#define REHUGE     ((size_t)1<<21)       /* with THREADS, mmap blocks this big */
 
 struct recycle
 {
@@ -29,16 +59,53 @@ struct recycle
 };
 typedef  struct recycle  recycle;
 
+/* the header of each block of items */
+struct reblock
+{
+   struct reblock *next;     /* next block of the same root */
+   size_t          len;      /* length of this block, header included */
+};
+typedef  struct reblock  reblock;
+
 struct reroot
 {
-   struct recycle *list;     /* list of malloced blocks */
+   struct reblock *list;     /* list of malloced blocks */
    struct recycle *trash;    /* list of deleted items */
+   struct reblock *spare;    /* blocks kept by rereset and rerewind */
    size_t          size;     /* size of an item */
    size_t          logsize;  /* log_2 of number of items in a block */
    word            numleft;  /* number of bytes left in this block */
+#ifdef THREADS
+   void           *owner;    /* the thread that renews from this root */
+   struct recycle *remote;   /* items deleted by other threads */
+#endif
+#ifdef RESTATS
+   char           *label;    /* what this root holds, or 0 */
+   size_t          blocks;   /* number of blocks in list */
+   size_t          nspare;   /* number of blocks in spare */
+   size_t          bytes;    /* bytes in list and spare, headers included */
+   size_t          live;     /* items renewed and not yet redel'd */
+   size_t          ntrash;   /* items on the trash list */
+   size_t          peak;     /* the most items ever live at once */
+   struct reroot  *rnext;    /* next root in the registry */
+   struct reroot  *rprev;    /* previous root in the registry */
+#endif
 };
 typedef  struct reroot  reroot;
 
+/* a position to rewind a root to */
+struct reframe
+{
+   struct reblock *list;     /* the block being used at the mark */
+   struct recycle *trash;    /* trash set aside by the mark */
+   word            numleft;  /* bytes left in that block */
+#ifdef RESTATS
+   size_t          live;
+   size_t          ntrash;
+#endif
+};
+typedef  struct reframe  reframe;
+
 /* make a new recycling root */
 reroot  *remkroot(/*_ size_t mysize _*/);
 
@@ -46,20 +113,50 @@ reroot  *remkroot(/*_ size_t mysize _*/);
 void     refree(/*_ struct reroot *r _*/);
 
 /* get a new (cleared) item from the root */
+#ifdef RESTATS
+#define renew(r) renewx(r)
+#else
 #define renew(r) ((r)->numleft ? \
    (((char *)((r)->list+1))+((r)->numleft-=(r)->size)) : renewx(r))
+#endif
 
 char    *renewx(/*_ struct reroot *r _*/);
 
 /* delete an item; let the root recycle it */
 /* void     redel(/o_ struct reroot *r, struct recycle *item _o/); */
+#if defined(THREADS) || defined(RESTATS)
+#define redel(root,item) redelx((root), (char *)(item))
+void     redelx(/*_ struct reroot *r, char *item _*/);
+#else
 #define redel(root,item) { \
    ((recycle *)item)->next=(root)->trash; \
    (root)->trash=(recycle *)(item); \
 }
+#endif
+
+/* forget every item in a root, but keep its blocks */
+void     rereset(/*_ struct reroot *r _*/);
+
+/* remember a position, and forget everything renewed since then */
+void     remark(/*_ struct reroot *r, struct reframe *f _*/);
+void     rerewind(/*_ struct reroot *r, struct reframe *f _*/);
 
 /* malloc, but complain to stderr and exit program if no joy */
 /* use plain free() to free memory allocated by remalloc() */
 char    *remalloc(/*_ size_t len, char *purpose _*/);
 
+#ifdef THREADS
+/* TRUE: try to back blocks of REHUGE bytes or more with huge pages */
+void     rehugepages(/*_ word on _*/);
+#endif
+
+#ifdef RESTATS
+/* name a root, print the counts for one root, print every root */
+#define  relabel(r,name) ((r)->label = (name))
+void     restat(/*_ struct reroot *r _*/);
+void     restatall(/*_ void _*/);
+#else
+#define  relabel(r,name)
+#endif
+
 #endif  /* RECYCLE */
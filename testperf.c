@@ -2,8 +2,24 @@
 ----------------------------------------------------------------------------
 Test a perfect hash.
 By Bob Jenkins.  Public Domain.
+
+Compile this with the phash.c and phash.h that perfect wrote, then feed
+it the same keys and flags that were given to perfect:
+  perfect -hm < keys.txt
+  (compile with makeptst.txt)
+  foo -hm < keys.txt
+It checks that every key gets a distinct hash in 0..PHASHRANGE-1 (and in
+0..nkeys-1, if M was given), then times lookups of
+all the keys in sequential and in random order.  If perfect was given V,
+phash_batch() is checked and timed too; build fooavx2 from makeptst.txt
+to check its AVX2 path.  If perfect was given O, lines may be
+"key<tab>value", and phash_find() is checked to return every key's value.
+L lists each key's hash, as this used to do.
 ----------------------------------------------------------------------------
 */
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #ifndef STANDARD
 #include "standard.h"
 #endif
@@ -23,117 +39,406 @@ struct hashform
     HEX_HM,              /* key to be hashed is a hexidecimal 4-byte integer */
     DECIMAL_HM,          /* key to be hashed is a hexidecimal 4-byte integer */
     AB_HM,      /* key to be hashed is "A B", where A and B are (A,B) in hex */
-    ABDEC_HM                                /* same as AB_HM, but in decimal */
+    ABDEC_HM,                               /* same as AB_HM, but in decimal */
+    HEX8_HM,            /* key to be hashed is a hexidecimal 8-byte integer */
+    DECIMAL8_HM             /* key to be hashed is a decimal 8-byte integer */
   } mode;
+  enum {
+    NORMAL_HP,                                   /* just find a perfect hash */
+    MINIMAL_HP                                /* find a minimal perfect hash */
+  } perfect;
+  word list;                               /* TRUE: print every key's hash */
+  word keymap;          /* TRUE: lines are "key<tab>value", check phash_find */
 };
 typedef  struct hashform  hashform;
 
-#define MAXKEYLEN  30
+#define BENCHLOOKUPS 10000000  /* time at least this many lookups per test */
+
+/* a key, with its numbers already parsed so parsing isn't timed */
 struct key
 {
-  char *kname;
-  ub4   klen;
-  struct key *knext;
+  char *kname;                                       /* the text of the key */
+  ub4   klen;                                      /* length of the text */
+  ub4   a;                       /* the integer, or A of an (A,B) pair */
+  ub4   b;                                        /* B of an (A,B) pair */
+  ub8   a8;                                      /* the 8-byte integer */
+  ub4   val;                /* the value after the tab, or the line number */
 };
 typedef  struct key  key;
 
-/* get the list of keys */
-static void getkeys(keys, nkeys, textroot, keyroot)
-key    **keys;        /* list of all keys */
-ub4     *nkeys;       /* number of keys */
-reroot  *textroot;    /* get space to store key text */
-reroot  *keyroot;     /* get space for keys */
+/* read all of stdin into one buffer */
+static char *readall(len)
+size_t *len;
+{
+  size_t  size = 1<<16;
+  size_t  got;
+  char   *text = (char *)remalloc(size, "testperf.c, text");
+
+  *len = 0;
+  while ((got = fread(text + *len, 1, size - *len, stdin)) > 0)
+  {
+    *len += got;
+    if (*len == size)
+    {
+      char *bigger = (char *)remalloc(size*2, "testperf.c, text");
+      memcpy(bigger, text, size);
+      free(text);
+      text = bigger;
+      size *= 2;
+    }
+  }
+  return text;
+}
+
+/* get the array of keys, one key per line, in the order given */
+static void getkeys(keys, nkeys, text, form)
+key     **keys;        /* array of all keys */
+ub4      *nkeys;       /* number of keys */
+char    **text;        /* the text the keys point into */
+hashform *form;
+{
+  size_t  len, i;
+  char   *s;
+  key    *mykey;
+  char    num[80];
+
+  s = *text = readall(&len);
+  *nkeys = 0;
+  for (i=0; i<len; ++i)
+    if (s[i] == '\n') ++*nkeys;
+  if (len > 0 && s[len-1] != '\n') ++*nkeys;
+  *keys = (key *)remalloc(sizeof(key)*(*nkeys+1), "testperf.c, keys");
+
+  for (mykey = *keys, i=0; i<len; ++mykey)
+  {
+    size_t j;
+    for (j=i; j<len && s[j] != '\n'; ++j)
+      ;
+    mykey->kname = &s[i];
+    mykey->klen  = (ub4)(j-i);
+    mykey->a = mykey->b = 0;
+    mykey->a8 = 0;
+    mykey->val = (ub4)(mykey - *keys);       /* by default, the line number */
+    if (form->keymap)
+    {                             /* "key<tab>value": the key ends at the tab */
+      size_t t;
+      for (t=j; t>i && s[t-1] != '\t'; --t)
+	;
+      if (t > i)
+      {
+	mykey->klen = (ub4)(t-1-i);
+	mykey->val = (ub4)(strtoul(&s[t], (char **)0, 0) & 0xffffffff);
+      }
+    }
+    if (form->mode != NORMAL_HM && form->mode != INLINE_HM)
+    {
+      size_t n = (mykey->klen < sizeof(num)) ? mykey->klen : sizeof(num)-1;
+      memcpy(num, &s[i], n);
+      num[n] = '\0';
+      switch(form->mode)
+      {
+      case HEX_HM:      sscanf(num, "%lx ", &mykey->a); break;
+      case DECIMAL_HM:  sscanf(num, "%ld ", &mykey->a); break;
+      case AB_HM:       sscanf(num, "%lx %lx ", &mykey->a, &mykey->b); break;
+      case ABDEC_HM:    sscanf(num, "%ld %ld ", &mykey->a, &mykey->b); break;
+      case HEX8_HM:     sscanf(num, "%llx ", &mykey->a8); break;
+      case DECIMAL8_HM: sscanf(num, "%llu ", &mykey->a8); break;
+      default: break;
+      }
+    }
+    i = j+1;
+  }
+}
+
+/* the initial hash INLINE_HM expects the user to compute */
+static ub4 inlhash(k)
+key *k;
+{
+  ub4 hash = PHASHSALT;
+  ub4 i;
+  for (i=0; i<k->klen; ++i)
+    hash = (k->kname[i] ^ hash) + ((hash<<26)+(hash>>6));
+  return hash;
+}
+
+/* the perfect hash of one key */
+static ub4 hashkey(form, k)
+hashform *form;
+key      *k;
+{
+  switch(form->mode)
+  {
+  case NORMAL_HM:   return phash(k->kname, (int)k->klen);
+  case INLINE_HM:   return phash(inlhash(k));
+  case HEX_HM:
+  case DECIMAL_HM:  return phash(k->a);
+  case AB_HM:
+  case ABDEC_HM:    return phash(k->a, k->b);
+  case HEX8_HM:
+  case DECIMAL8_HM: return phash(k->a8);
+  }
+  return 0;
+}
+
+/* check that the hash is perfect, and minimal if asked.  Returns #bad. */
+static ub4 verify(form, keys, nkeys)
+hashform *form;
+key      *keys;
+ub4       nkeys;
+{
+  ub1 *seen = (ub1 *)remalloc((size_t)PHASHRANGE+1, "testperf.c, seen");
+  ub4  i, bad = 0, high = 0;
+
+  memset(seen, 0, (size_t)PHASHRANGE+1);
+  for (i=0; i<nkeys; ++i)
+  {
+    ub4 hash = hashkey(form, &keys[i]);
+    if (form->list)
+      printf("%8ld  %.*s\n", hash, (int)keys[i].klen, keys[i].kname);
+    if (hash >= PHASHRANGE)
+    {
+      printf("out of range: %ld  %.*s\n", hash,
+	     (int)keys[i].klen, keys[i].kname);
+      ++bad;
+    }
+    else if (seen[hash]++)
+    {
+      printf("collision: %ld  %.*s\n", hash,
+	     (int)keys[i].klen, keys[i].kname);
+      ++bad;
+    }
+    if (hash > high) high = hash;
+  }
+  if (form->perfect == MINIMAL_HP && high >= nkeys)
+  {                   /* distinct hashes all below nkeys cover 0..nkeys-1 */
+    printf("not minimal: hashes go up to %ld for %ld keys\n", high, nkeys);
+    ++bad;
+  }
+  free(seen);
+  return bad;
+}
+
+#ifdef PHASHMAPLEN
+/* check that phash_find() returns every key's value.  Returns #bad. */
+static ub4 verifymap(form, keys, nkeys)
+hashform *form;
+key      *keys;
+ub4       nkeys;
+{
+  ub4 i, val, bad = 0;
+
+  for (i=0; i<nkeys; ++i)
+  {
+    key *k = &keys[i];
+    switch(form->mode)
+    {
+    case NORMAL_HM:
+    case INLINE_HM:   val = phash_find(k->kname, (int)k->klen); break;
+    case HEX8_HM:
+    case DECIMAL8_HM: val = phash_find(k->a8); break;
+    default:          val = phash_find(k->a); break;
+    }
+    if (val != k->val)
+    {
+      printf("wrong value: %lx, not %lx  %.*s\n", val, k->val,
+	     (int)k->klen, k->kname);
+      ++bad;
+    }
+  }
+  return bad;
+}
+#endif /* PHASHMAPLEN */
+
+/* time rounds passes of looking up keys[order[0..nkeys-1]], in seconds */
+static double bench(form, keys, order, nkeys, rounds, sum)
+hashform *form;
+key      *keys;
+ub4      *order;
+ub4       nkeys;
+ub4       rounds;
+ub4      *sum;                   /* hashes are added here so they get used */
+{
+  clock_t start = clock();
+  ub4     r, i, s = 0;
+
+#define BENCHLOOP(expr) \
+  for (r=0; r<rounds; ++r) \
+    for (i=0; i<nkeys; ++i) \
+    { \
+      key *k = &keys[order[i]]; \
+      s += (expr); \
+    }
+
+  switch(form->mode)
+  {
+  case NORMAL_HM:   BENCHLOOP(phash(k->kname, (int)k->klen)); break;
+  case INLINE_HM:   BENCHLOOP(phash(inlhash(k))); break;
+  case HEX_HM:
+  case DECIMAL_HM:  BENCHLOOP(phash(k->a)); break;
+  case AB_HM:
+  case ABDEC_HM:    BENCHLOOP(phash(k->a, k->b)); break;
+  case HEX8_HM:
+  case DECIMAL8_HM: BENCHLOOP(phash(k->a8)); break;
+  }
+#undef BENCHLOOP
+
+  *sum += s;
+  return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+#ifdef PHASHBATCH
+/* check and time phash_batch() on the keys in the given order */
+static double benchbatch(form, keys, order, nkeys, rounds, bad)
+hashform *form;
+key      *keys;
+ub4      *order;
+ub4       nkeys;
+ub4       rounds;
+ub4      *bad;                          /* count of wrong hashes, output */
 {
-  key  *mykey;
-  char *mytext;
-  mytext = (char *)renew(textroot);
-  *keys  = (key *)0;
-  *nkeys = (ub4)0;
-  while (fgets(mytext, MAXKEYLEN, stdin))
+  word     wide = (form->mode == HEX8_HM || form->mode == DECIMAL8_HM);
+  ub4     *in4 = (ub4 *)remalloc(sizeof(ub4)*(nkeys+1), "testperf.c, in4");
+  ub8     *in8 = (ub8 *)remalloc(sizeof(ub8)*(nkeys+1), "testperf.c, in8");
+  ub4     *out = (ub4 *)remalloc(sizeof(ub4)*(nkeys+1), "testperf.c, out");
+  ub4      r, i;
+  clock_t  start;
+  double   secs;
+
+  for (i=0; i<nkeys; ++i)
+  {
+    in4[i] = keys[order[i]].a;
+    in8[i] = keys[order[i]].a8;
+  }
+  start = clock();
+  for (r=0; r<rounds; ++r)
   {
-    ub4 i;
-    mykey = (key *)renew(keyroot);
-    mykey->kname = (ub1 *)mytext;
-    mytext = (char *)renew(textroot);
-    mykey->klen  = (ub4)(strlen((char *)mykey->kname)-1);
-    mykey->knext = *keys;
-    *keys = mykey;
-    ++*nkeys;
+    if (wide)
+      phash_batch(in8, out, (size_t)nkeys);
+    else
+      phash_batch(in4, out, (size_t)nkeys);
   }
-  redel(textroot, mytext);
+  secs = (double)(clock() - start) / CLOCKS_PER_SEC;
+  *bad = 0;
+  for (i=0; i<nkeys; ++i)
+    if (out[i] != hashkey(form, &keys[order[i]]))
+      ++*bad;
+  free(in4);
+  free(in8);
+  free(out);
+  return secs;
 }
+#endif /* PHASHBATCH */
 
+/* report the speed of a test */
+static void report(name, secs, lookups)
+char   *name;
+double  secs;
+double  lookups;
+{
+  if (secs > 0.0)
+    printf("%-18s %12.0f lookups/second  (%.3f seconds)\n",
+	   name, lookups/secs, secs);
+  else
+    printf("%-18s too fast to time\n", name);
+}
 
 /*
 ------------------------------------------------------------------------------
-Read in the keys, find the hash, and write the .c and .h files
+Read in the keys, check the hash, and time it
 ------------------------------------------------------------------------------
 */
-void driver(form)
+ub4 driver(form)
 hashform *form;
 {
   ub4     nkeys;      /* number of keys */
-  key    *keys;       /* head of list of keys */
-  key    *mykey;
-  reroot *textroot;   /* MAXKEYLEN-character text lines */
-  reroot *keyroot;    /* source of keys */
-
-  /* set up memory sources */
-  textroot = remkroot((size_t)MAXKEYLEN);
-  keyroot  = remkroot(sizeof(key));
+  key    *keys;       /* array of all keys */
+  char   *text;       /* text of all keys */
+  ub4    *seq;        /* 0..nkeys-1 */
+  ub4    *shuf;       /* 0..nkeys-1 in random order */
+  ub4     i, bad, rounds, sum = 0;
 
   /* read in the list of keywords */
-  getkeys(&keys, &nkeys, textroot, keyroot);
+  getkeys(&keys, &nkeys, &text, form);
   printf("Read in %ld keys\n",nkeys);
+  if (nkeys == 0)
+    return 0;
 
-  for (mykey=keys; mykey; mykey=mykey->knext)
+  bad = verify(form, keys, nkeys);
+  if (bad)
   {
-    ub4 hash;
-    ub4 i;
-    ub4 a;
-    ub4 b;
-    switch(form->mode)
+    printf("%ld keys are bad, the hash is not %s\n", bad,
+	   (form->perfect == MINIMAL_HP) ? "minimal perfect" : "perfect");
+    free(keys);
+    free(text);
+    return bad;
+  }
+  printf("The hash is %s, range 0..%ld\n",
+	 (form->perfect == MINIMAL_HP) ? "minimal perfect" : "perfect",
+	 (form->perfect == MINIMAL_HP) ? nkeys-1 : (ub4)PHASHRANGE-1);
+#ifdef PHASHMAPLEN
+  if (form->keymap)
+  {
+    bad = verifymap(form, keys, nkeys);
+    if (bad)
     {
-    case NORMAL_HM:
-      hash = phash(mykey->kname, mykey->klen);  
-      break;
-    case INLINE_HM:
-      hash = PHASHSALT;
-      for (i=0; i<mykey->klen; ++i)
-      {
-	hash = (mykey->kname[i] ^ hash) + ((hash<<26)+(hash>>6));
-      }
-      hash = phash(hash);
-      break;
-    case HEX_HM:
-      sscanf(mykey->kname, "%lx ", &hash);
-      hash = phash(hash);
-      break;
-    case DECIMAL_HM:
-      sscanf(mykey->kname, "%ld ", &hash);
-      hash = phash(hash);
-      break;
-    case AB_HM:
-      sscanf(mykey->kname, "%lx %lx ", &a, &b);
-      hash = phash(a,b);
-      break;
-    case ABDEC_HM:
-      sscanf(mykey->kname, "%ld %ld ", &a, &b);
-      hash = phash(a,b);
-      break;
+      printf("phash_find returns the wrong value for %ld keys\n", bad);
+      free(keys);
+      free(text);
+      return bad;
     }
-    printf("%8d  %.*s\n", hash, mykey->klen, mykey->kname);
+    printf("phash_find returns every key's value\n");
+  }
+#endif
+
+  /* orders to look up the keys in */
+  seq  = (ub4 *)remalloc(sizeof(ub4)*nkeys, "testperf.c, seq");
+  shuf = (ub4 *)remalloc(sizeof(ub4)*nkeys, "testperf.c, shuf");
+  for (i=0; i<nkeys; ++i)
+    seq[i] = shuf[i] = i;
+  srand(1);
+  for (i=nkeys; i>1; --i)
+  {
+    ub4 j = ((((ub4)rand()) << 15) ^ (ub4)rand()) % i;
+    ub4 t = shuf[i-1];
+    shuf[i-1] = shuf[j];
+    shuf[j] = t;
   }
 
-  /* clean up memory sources */
-  refree(textroot);
-  refree(keyroot);
+  rounds = (BENCHLOOKUPS + nkeys - 1) / nkeys;
+  report("sequential:", bench(form, keys, seq, nkeys, rounds, &sum),
+	 (double)rounds*nkeys);
+  report("random:", bench(form, keys, shuf, nkeys, rounds, &sum),
+	 (double)rounds*nkeys);
+#ifdef PHASHBATCH
+  if (form->mode == HEX_HM || form->mode == DECIMAL_HM ||
+      form->mode == HEX8_HM || form->mode == DECIMAL8_HM)
+  {
+    double secs;
+    secs = benchbatch(form, keys, seq, nkeys, rounds, &bad);
+    report("batch sequential:", secs, (double)rounds*nkeys);
+    if (bad)
+      printf("phash_batch disagrees with phash for %ld keys\n", bad);
+    secs = benchbatch(form, keys, shuf, nkeys, rounds, &i);
+    report("batch random:", secs, (double)rounds*nkeys);
+    if (i)
+      printf("phash_batch disagrees with phash for %ld keys\n", i);
+    bad += i;
+  }
+#endif
+  printf("checksum of all hashes: %.8lx\n", sum);
+
+  free(seq);
+  free(shuf);
+  free(keys);
+  free(text);
+  return bad;
 }
 
 
 void usage_error()
 {
   printf("usage is the same as perfect (which see)\n");
+  printf("  L,l: also list every key's hash\n");
   exit(SUCCESS);
 }
 
@@ -146,6 +451,9 @@ char **argv;
   int       mode_given = 0;
 
   form.mode = NORMAL_HM;
+  form.perfect = MINIMAL_HP;
+  form.list = FALSE;
+  form.keymap = FALSE;
 
   /* let the user override the default behavior */
   switch (argc)
@@ -166,7 +474,9 @@ char **argv;
     case 'd': case 'D':
     case 'a': case 'A':
     case 'b': case 'B':
-      if (mode_given == TRUE) 
+    case 'x': case 'X':
+    case 'y': case 'Y':
+      if (mode_given == TRUE)
 	usage_error();
       switch(*c)
       {
@@ -182,13 +492,33 @@ char **argv;
 	form.mode = AB_HM; break;
       case 'b': case 'B':
 	form.mode = ABDEC_HM; break;
+      case 'x': case 'X':
+	form.mode = HEX8_HM; break;
+      case 'y': case 'Y':
+	form.mode = DECIMAL8_HM; break;
       }
       mode_given = TRUE;
       break;
     case 'm': case 'M':
+      form.perfect = MINIMAL_HP;
+      break;
     case 'p': case 'P':
+      form.perfect = NORMAL_HP;
+      break;
+    case 'l': case 'L':
+      form.list = TRUE;
+      break;
+    case 'o': case 'O':
+      form.keymap = TRUE;
+      break;
     case 'f': case 'F':
     case 's': case 'S':
+    case 'g': case 'G':
+    case 'v': case 'V':
+      break;
+    case 't': case 'T':
+      while (c[1] >= '0' && c[1] <= '9')
+	++c;
       break;
     default:
       usage_error();
@@ -198,6 +528,5 @@ char **argv;
     usage_error();
   }
 
-  driver(&form);
-  return 1;
+  return (driver(&form) == 0) ? SUCCESS : 1;
 }